@@ -0,0 +1,25 @@
+# Runs the scheduler microbenchmarks against RR, MLFQ and native pthreads and
+# collects every row into one file, e.g. ./bench.sh csv 1,8,64
+FORMAT=${1:-csv}
+COUNTS=${2:-1,2,4,8,16,32,64,100}
+OUT=bench_results.$FORMAT
+
+rm -f bench_*.part
+for SCHED in RR MLFQ; do
+	make -C .. SCHED=$SCHED LOG_LEVEL=NONE > /dev/null
+	make clean > /dev/null
+	make bench_sched > /dev/null
+	./bench_sched -l $SCHED -t $COUNTS -f $FORMAT -o bench_$SCHED.part
+done
+make bench_pthread > /dev/null
+./bench_pthread -l pthread -t $COUNTS -f $FORMAT -o bench_pthread.part
+
+if [ "$FORMAT" = "json" ]; then
+	# splice the per run arrays into one
+	(echo "["; cat bench_RR.part bench_MLFQ.part bench_pthread.part | grep '^  {' | sed '$!s/}$/},/; $s/},$/}/'; echo "]") > $OUT
+else
+	(head -1 bench_RR.part; tail -q -n +2 bench_RR.part bench_MLFQ.part bench_pthread.part) > $OUT
+fi
+rm -f bench_*.part
+rm -f bench_sched bench_pthread
+echo "results written to $OUT"
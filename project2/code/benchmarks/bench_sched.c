@@ -0,0 +1,397 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Scheduler microbenchmarks with machine readable results.
+ *
+ * Built three ways from the same source (see bench.sh):
+ *   gcc -o bench_sched bench_sched.c -L../ -lthread-worker -lm  (RR or MLFQ)
+ *   gcc -DNATIVE_PTHREAD -o bench_pthread bench_sched.c -lpthread -lm
+ *
+ *   $ ./bench_sched -l RR -t 1,8,64 -f json -o rr.json
+ *
+ * Every result is one row: label,benchmark,threads,iterations,value,unit
+ */
+
+#ifdef NATIVE_PTHREAD
+#include <pthread.h>
+#include <sched.h>
+typedef pthread_t worker_t;
+typedef pthread_mutex_t worker_mutex_t;
+#define worker_create pthread_create
+#define worker_join pthread_join
+#define worker_yield sched_yield
+#define worker_mutex_init pthread_mutex_init
+#define worker_mutex_lock pthread_mutex_lock
+#define worker_mutex_unlock pthread_mutex_unlock
+#define worker_mutex_destroy pthread_mutex_destroy
+#define DEFAULT_LABEL "pthread"
+#else
+#include "../thread-worker.h"
+#define DEFAULT_LABEL "worker"
+#endif
+
+#define MAX_THREADS 128
+#define CREATE_TOTAL 4096
+#define YIELD_LOOP 2000
+#define MUTEX_LOOP 1000000
+#define CONTENDED_LOOP 20000
+#define JITTER_RUN_NS 500000000ULL // half a second per thread count
+#define JITTER_GAP_NS 50000ULL     // off cpu longer than this ends a slice
+#define JITTER_SLICES 4096
+
+typedef struct result
+{
+	const char *bench;
+	int threads;
+	long iterations;
+	double value;
+	const char *unit;
+} result;
+
+static result results[256];
+static int result_cnt = 0;
+
+static worker_mutex_t mutex;
+static volatile long shared = 0;
+static volatile int jitter_stop = 0;
+static unsigned long long jitter_start = 0;
+
+typedef struct jitter_data
+{
+	unsigned long long slices[JITTER_SLICES];
+	int count;
+} jitter_data;
+
+static jitter_data jitter[MAX_THREADS];
+
+static unsigned long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void add_result(const char *bench, int threads, long iterations, double value, const char *unit)
+{
+	if (result_cnt < sizeof(results) / sizeof(results[0]))
+	{
+		result r = {bench, threads, iterations, value, unit};
+		results[result_cnt++] = r;
+	}
+}
+
+static void *noop_work(void *arg)
+{
+	return arg;
+}
+
+static void *yield_work(void *arg)
+{
+	for (int i = 0; i < YIELD_LOOP; i++)
+	{
+		worker_yield();
+	}
+	return NULL;
+}
+
+static void *contended_work(void *arg)
+{
+	for (int i = 0; i < CONTENDED_LOOP; i++)
+	{
+		worker_mutex_lock(&mutex);
+		shared++;
+		worker_mutex_unlock(&mutex);
+	}
+	return NULL;
+}
+
+// a slice is a stretch of time the thread kept the cpu without a gap
+static void *jitter_work(void *arg)
+{
+	jitter_data *data = arg;
+	unsigned long long last = now_ns(), slice_start = last;
+	data->count = 0;
+
+	while (!jitter_stop)
+	{
+		unsigned long long t = now_ns();
+
+		if (t - last > JITTER_GAP_NS)
+		{
+			if (data->count < JITTER_SLICES)
+			{
+				data->slices[data->count++] = last - slice_start;
+			}
+			slice_start = t;
+		}
+		last = t;
+
+		if (t - jitter_start > JITTER_RUN_NS)
+		{
+			jitter_stop = 1;
+		}
+	}
+	return NULL;
+}
+
+static void bench_create_join(int threads)
+{
+	worker_t thread[MAX_THREADS];
+	int rounds = CREATE_TOTAL / threads;
+	unsigned long long start = now_ns();
+
+	for (int r = 0; r < rounds; r++)
+	{
+		for (int i = 0; i < threads; i++)
+		{
+			worker_create(&thread[i], NULL, &noop_work, NULL);
+		}
+
+		for (int i = 0; i < threads; i++)
+		{
+			worker_join(thread[i], NULL);
+		}
+	}
+	double secs = (now_ns() - start) / 1e9;
+	add_result("create_join", threads, (long)rounds * threads, rounds * threads / secs, "threads/s");
+}
+
+static void bench_yield(int threads)
+{
+	worker_t thread[MAX_THREADS];
+	unsigned long long start = now_ns();
+
+	for (int i = 0; i < threads; i++)
+	{
+		worker_create(&thread[i], NULL, &yield_work, NULL);
+	}
+
+	for (int i = 0; i < threads; i++)
+	{
+		worker_join(thread[i], NULL);
+	}
+	long yields = (long)threads * YIELD_LOOP;
+	add_result("yield", threads, yields, (double)(now_ns() - start) / yields, "ns/yield");
+}
+
+static void bench_mutex_uncontended()
+{
+	unsigned long long start = now_ns();
+
+	for (int i = 0; i < MUTEX_LOOP; i++)
+	{
+		worker_mutex_lock(&mutex);
+		shared++;
+		worker_mutex_unlock(&mutex);
+	}
+	add_result("mutex_uncontended", 1, MUTEX_LOOP, (double)(now_ns() - start) / MUTEX_LOOP, "ns/op");
+}
+
+static void bench_mutex_contended(int threads)
+{
+	worker_t thread[MAX_THREADS];
+	shared = 0;
+	unsigned long long start = now_ns();
+
+	for (int i = 0; i < threads; i++)
+	{
+		worker_create(&thread[i], NULL, &contended_work, NULL);
+	}
+
+	for (int i = 0; i < threads; i++)
+	{
+		worker_join(thread[i], NULL);
+	}
+	long ops = (long)threads * CONTENDED_LOOP;
+	add_result("mutex_contended", threads, ops, (double)(now_ns() - start) / ops, "ns/op");
+
+	if (shared != ops)
+	{
+		fprintf(stderr, "mutex_contended: counter %ld, expected %ld\n", shared, ops);
+	}
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void bench_jitter(int threads)
+{
+	worker_t thread[MAX_THREADS];
+	jitter_stop = 0;
+	jitter_start = now_ns();
+
+	for (int i = 0; i < threads; i++)
+	{
+		worker_create(&thread[i], NULL, &jitter_work, &jitter[i]);
+	}
+
+	for (int i = 0; i < threads; i++)
+	{
+		worker_join(thread[i], NULL);
+	}
+
+	// the first slice of every thread starts at creation, it is not a full one
+	int total = 0;
+	for (int i = 0; i < threads; i++)
+	{
+		total += jitter[i].count > 1 ? jitter[i].count - 1 : 0;
+	}
+
+	if (total == 0)
+	{
+		add_result("slice_p50", threads, 0, 0, "us");
+		return;
+	}
+	unsigned long long *slices = malloc(total * sizeof(unsigned long long));
+	int n = 0;
+	double sum = 0;
+	for (int i = 0; i < threads; i++)
+	{
+		for (int j = 1; j < jitter[i].count; j++)
+		{
+			slices[n++] = jitter[i].slices[j];
+			sum += jitter[i].slices[j];
+		}
+	}
+	qsort(slices, n, sizeof(unsigned long long), cmp_ull);
+	double mean = sum / n, var = 0;
+	for (int i = 0; i < n; i++)
+	{
+		var += (slices[i] - mean) * (slices[i] - mean);
+	}
+	add_result("slice_mean", threads, n, mean / 1000.0, "us");
+	add_result("slice_p50", threads, n, slices[n / 2] / 1000.0, "us");
+	add_result("slice_p99", threads, n, slices[(n * 99) / 100] / 1000.0, "us");
+	add_result("slice_stddev", threads, n, sqrt(var / n) / 1000.0, "us");
+	free(slices);
+}
+
+static void write_results(FILE *out, const char *label, int is_json)
+{
+	if (is_json)
+	{
+		fprintf(out, "[\n");
+	}
+	else
+	{
+		fprintf(out, "label,benchmark,threads,iterations,value,unit\n");
+	}
+
+	for (int i = 0; i < result_cnt; i++)
+	{
+		result *r = &results[i];
+
+		if (is_json)
+		{
+			fprintf(out, "  {\"label\":\"%s\",\"benchmark\":\"%s\",\"threads\":%d,\"iterations\":%ld,\"value\":%.3f,\"unit\":\"%s\"}%s\n",
+					label, r->bench, r->threads, r->iterations, r->value, r->unit, i + 1 < result_cnt ? "," : "");
+		}
+		else
+		{
+			fprintf(out, "%s,%s,%d,%ld,%.3f,%s\n", label, r->bench, r->threads, r->iterations, r->value, r->unit);
+		}
+	}
+
+	if (is_json)
+	{
+		fprintf(out, "]\n");
+	}
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [-l label] [-t 1,2,4,...] [-f csv|json] [-o file] [-b create,yield,mutex,jitter]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	const char *label = DEFAULT_LABEL, *out_path = NULL, *benches = "create,yield,mutex,jitter";
+	char counts[256] = "1,2,4,8,16,32,64,100";
+	int is_json = 0, opt;
+
+	while ((opt = getopt(argc, argv, "l:t:f:o:b:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'l':
+			label = optarg;
+			break;
+		case 't':
+			strncpy(counts, optarg, sizeof(counts) - 1);
+			break;
+		case 'f':
+			is_json = strcmp(optarg, "json") == 0;
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		case 'b':
+			benches = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	worker_mutex_init(&mutex, NULL);
+
+	if (strstr(benches, "mutex"))
+	{
+		bench_mutex_uncontended();
+	}
+
+	for (char *tok = strtok(counts, ","); tok; tok = strtok(NULL, ","))
+	{
+		int threads = atoi(tok);
+
+		if (threads < 1 || threads > MAX_THREADS)
+		{
+			fprintf(stderr, "skipping thread count %s (1..%d)\n", tok, MAX_THREADS);
+			continue;
+		}
+		fprintf(stderr, "%s: %d threads\n", label, threads);
+
+		if (strstr(benches, "create"))
+		{
+			bench_create_join(threads);
+		}
+
+		if (strstr(benches, "yield"))
+		{
+			bench_yield(threads);
+		}
+
+		if (strstr(benches, "mutex"))
+		{
+			bench_mutex_contended(threads);
+		}
+
+		if (strstr(benches, "jitter"))
+		{
+			bench_jitter(threads);
+		}
+	}
+	worker_mutex_destroy(&mutex);
+
+	FILE *out = out_path ? fopen(out_path, "w") : stdout;
+	if (out == NULL)
+	{
+		perror(out_path);
+		return 1;
+	}
+	write_results(out, label, is_json);
+
+	if (out != stdout)
+	{
+		fclose(out);
+	}
+	return 0;
+}
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../thread-worker.h"
+#include "../mutex_types.h"
+
+/* Priority inheritance with two mutexes unlocked out of order (MLFQ).
+ *
+ * main holds A and B while urgent threads block on each, then gives up A
+ * first. It has to keep the priority lent through B until B is unlocked
+ * too, and then fall back to its own, demoted, level. Needs the library
+ * built with SCHED=MLFQ.
+ */
+
+#define SPIN_LOOP 400000000
+
+worker_mutex_t mutex_a, mutex_b;
+
+static tcb *self_tcb()
+{
+	return ((list_node_t *)worker_self())->t_block;
+}
+
+static tcb *thread_tcb(worker_t thread)
+{
+	return ((list_node_t *)thread)->t_block;
+}
+
+void *lock_work(void *arg)
+{
+	worker_mutex_t *mutex = arg;
+	worker_mutex_lock(mutex);
+	worker_mutex_unlock(mutex);
+	return NULL;
+}
+
+static int check(int ok, const char *what)
+{
+	printf("%s: %s\n", ok ? "ok" : "FAILED", what);
+	return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+	worker_t waiter_a, waiter_b;
+	int failed = 0;
+
+	worker_mutex_init(&mutex_a, NULL);
+	worker_mutex_init(&mutex_b, NULL);
+	// the waiters only run once main's slice is over, it locks both first
+	worker_create(&waiter_a, NULL, &lock_work, &mutex_a);
+	worker_create(&waiter_b, NULL, &lock_work, &mutex_b);
+	worker_mutex_lock(&mutex_a);
+	worker_mutex_lock(&mutex_b);
+
+	// burn whole quanta, the waiters block and main's own level drops
+	for (volatile long i = 0; i < SPIN_LOOP; i++)
+	{
+	}
+
+	tcb *self = self_tcb();
+	if (!(thread_tcb(waiter_a)->status & WAITING_T) || !(thread_tcb(waiter_b)->status & WAITING_T))
+	{
+		printf("waiters did not block, nothing to check\n");
+		return 1;
+	}
+	failed |= check(self->priority == URGENT_PRIORITY_T, "owner lifted to the waiters' priority");
+	failed |= check(self->base_priority < URGENT_PRIORITY_T, "owner's own level demoted meanwhile");
+
+	worker_mutex_unlock(&mutex_a);
+	failed |= check(self->priority == URGENT_PRIORITY_T, "priority lent through B kept after unlocking A");
+
+	worker_mutex_unlock(&mutex_b);
+	failed |= check(self->priority == self->base_priority, "own level back after unlocking B");
+
+	worker_join(waiter_a, NULL);
+	worker_join(waiter_b, NULL);
+	worker_mutex_destroy(&mutex_a);
+	worker_mutex_destroy(&mutex_b);
+	return failed;
+}
@@ -31,6 +31,8 @@ typedef struct worker_mutex_t {
   atomic_t mutex_lock;
   d_list_t *block_list;
   atomic_t list_lock;
+  struct tcb *owner;
+  struct worker_mutex_t *held_next; // in the owner's held list
 } worker_mutex_t;
 
 struct d_list_t *init_list(struct tcb *data);
@@ -0,0 +1,120 @@
+// File:	pthread_shim.c
+
+// Interposes the common pthread calls onto the worker library so an existing
+// pthread program runs on the user level scheduler without a rebuild:
+//   make shared SCHED=RR
+//   LD_PRELOAD=./libthread-worker.so ./program
+#include "thread-worker.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+
+/*
+ * pthread_mutex_t only carries a pointer to the worker mutex, created on
+ * first use so PTHREAD_MUTEX_INITIALIZER (all zeroes) works as well.
+ */
+static worker_mutex_t *shim_mutex(pthread_mutex_t *mutex) {
+  worker_mutex_t **slot = (worker_mutex_t **)mutex;
+  worker_mutex_t *w_mutex = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+
+  if (w_mutex) {
+    return w_mutex;
+  }
+
+  if ((w_mutex = malloc(sizeof(worker_mutex_t))) == NULL) {
+    DEBUG_OUT("Memory allocation for mutex failed");
+    return NULL;
+  }
+  worker_mutex_init(w_mutex, NULL);
+
+  worker_mutex_t *expected = NULL;
+  if (!__atomic_compare_exchange_n(slot, &expected, w_mutex, 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    // lost the race, another thread's mutex is already in place
+    worker_mutex_destroy(w_mutex);
+    free(w_mutex);
+    return expected;
+  }
+  return w_mutex;
+}
+
+int pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+                   void *(*start_routine)(void *), void *arg) {
+  worker_t w_thread;
+
+  if (worker_create(&w_thread, (pthread_attr_t *)attr, start_routine, arg) !=
+      SUCCESS_WCS) {
+    return EAGAIN;
+  }
+  *thread = (pthread_t)w_thread;
+  return 0;
+}
+
+int pthread_join(pthread_t thread, void **value_ptr) {
+  return worker_join((worker_t)thread, value_ptr) == SUCCESS_WCS ? 0 : EINVAL;
+}
+
+int pthread_detach(pthread_t thread) {
+  return worker_detach((worker_t)thread) == SUCCESS_WCS ? 0 : EINVAL;
+}
+
+void pthread_exit(void *value_ptr) {
+  worker_exit(value_ptr);
+  __builtin_unreachable();
+}
+
+pthread_t pthread_self(void) {
+  static pthread_t (*real_pthread_self)(void) = NULL;
+  worker_t self = worker_self();
+
+  if (self) {
+    return (pthread_t)self;
+  }
+
+  // the scheduler has not started yet, only the kernel thread exists
+  if (real_pthread_self == NULL) {
+    real_pthread_self = dlsym(RTLD_NEXT, "pthread_self");
+  }
+  return real_pthread_self();
+}
+
+int pthread_yield(void) {
+  worker_yield();
+  return 0;
+}
+
+int pthread_mutex_init(pthread_mutex_t *mutex,
+                       const pthread_mutexattr_t *mutexattr) {
+  *(worker_mutex_t **)mutex = NULL;
+  return shim_mutex(mutex) ? 0 : ENOMEM;
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+  worker_mutex_t *w_mutex = shim_mutex(mutex);
+  return w_mutex ? worker_mutex_lock(w_mutex) : ENOMEM;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *mutex) {
+  worker_mutex_t *w_mutex = shim_mutex(mutex);
+
+  if (w_mutex == NULL) {
+    return ENOMEM;
+  }
+  return worker_mutex_trylock(w_mutex) ? EBUSY : 0;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *mutex) {
+  worker_mutex_t *w_mutex = shim_mutex(mutex);
+  return w_mutex ? worker_mutex_unlock(w_mutex) : ENOMEM;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t *mutex) {
+  worker_mutex_t **slot = (worker_mutex_t **)mutex;
+  worker_mutex_t *w_mutex = __atomic_exchange_n(slot, NULL, __ATOMIC_ACQ_REL);
+
+  if (w_mutex) {
+    worker_mutex_destroy(w_mutex);
+    free(w_mutex);
+  }
+  return 0;
+}
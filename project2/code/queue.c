@@ -15,6 +15,23 @@ void queue_t_enqueue(tcb *t_block, struct sched_queue_t *queue) {
   new_node->next = queue->head;
 }
 
+// moves every node of from to the tail of queue at once, from is left empty
+void queue_t_splice(struct sched_queue_t *from, struct sched_queue_t *queue) {
+  if (from->head == NULL) {
+    return;
+  }
+
+  if (queue->tail) {
+    queue->tail->next = from->head;
+    queue->tail = from->tail;
+  } else {
+    queue->head = from->head;
+    queue->tail = from->tail;
+  }
+  queue->tail->next = queue->head;
+  from->head = from->tail = NULL;
+}
+
 tcb *queue_t_dequeue(struct sched_queue_t *queue) {
   q_node_t *curr_node = queue->head;
   tcb *t_block = curr_node->thread_block;
@@ -29,3 +46,32 @@ tcb *queue_t_dequeue(struct sched_queue_t *queue) {
   free(curr_node);
   return t_block;
 }
+
+// unlinks t_block from anywhere in the queue, returns 1 if it was present
+int queue_t_remove(tcb *t_block, struct sched_queue_t *queue) {
+  q_node_t *prev_node = queue->tail;
+  q_node_t *curr_node = queue->head;
+
+  if (curr_node == NULL) {
+    return 0;
+  }
+
+  do {
+    if (curr_node->thread_block == t_block) {
+      if (curr_node == queue->head) {
+        queue_t_dequeue(queue);
+        return 1;
+      }
+      prev_node->next = curr_node->next;
+
+      if (curr_node == queue->tail) {
+        queue->tail = prev_node;
+      }
+      free(curr_node);
+      return 1;
+    }
+    prev_node = curr_node;
+    curr_node = curr_node->next;
+  } while (curr_node != queue->head);
+  return 0;
+}
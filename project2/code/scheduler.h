@@ -11,9 +11,48 @@ typedef struct sched_queue_t {
   q_node_t *tail;
 } sched_queue_t;
 
+/*
+ * Fair-share group: the scheduler first picks the runnable group with the
+ * lowest pass (stride scheduling), then a thread from that group's queues.
+ */
+typedef struct sched_group_t {
+  int weight;
+  unsigned long stride; // GROUP_STRIDE / weight, charged per quantum used
+  unsigned long pass;
+  int threads; // live threads, the group can only be destroyed when 0
+  struct sched_queue_t *urgent_p_queue;
+  struct sched_queue_t *high_p_queue, *med_p_queue, *low_p_queue; // MLFQ
+  struct sched_group_t *next;
+} sched_group_t;
+
+// shared header of the threads made by one worker_create_n call, their tcbs
+// and stacks follow it in the same allocation
+typedef struct worker_batch_t {
+  int running;        // threads yet to exit, the last one wakes joiner
+  int unreaped;       // threads yet to be joined, the last one frees the block
+  struct tcb *joiner; // sleeping in worker_join_all
+} worker_batch_t;
+
 typedef struct scheduler {
   d_list_t *thread_blocks;
 
+  // LIFO slot for the thread just woken by an unlock or exit, dispatched
+  // ahead of the queues at most RUN_NEXT_LIMIT times in a row
+  struct tcb *run_next;
+  int run_next_streak;
+
+  // bumped on every entry, doubles as the rcu grace period clock
+  unsigned long ctx_switches;
+
+  // threads to wake, pushed lock free from any context and drained here
+  struct tcb *wake_inbox;
+  int parked_cnt; // the scheduler idles for the inbox instead of exiting
+
+  // scheduling groups, the default one first; group_pass is the pass of the
+  // last group picked so an idle group cannot bank up credit
+  struct sched_group_t *groups;
+  unsigned long group_pass;
+
   // should we include another lock for scheduler as well??
   // int scheduler_lock;
 
@@ -31,17 +70,26 @@ int init_scheduler();
 // threads even if worker_exit is not called
 void run_thread(void(*func(void *)), void *arg);
 
+// recycles the tcbs and stacks of detached threads that exited
+void reap_threads();
+void cache_tcb(struct tcb *t_block);
+
 /* SCHEDULER QUEUE */
 void queue_t_enqueue(struct tcb *t_block, struct sched_queue_t *queue);
 tcb *queue_t_dequeue(struct sched_queue_t *queue);
+void queue_t_splice(struct sched_queue_t *from, struct sched_queue_t *queue);
+int queue_t_remove(struct tcb *t_block, struct sched_queue_t *queue);
 
 /* SCHEDULER FUNCTIONS */
 void timer_sig_handler(int signum);
 static void swap_thread(struct sched_queue_t **queue);
+void wake_thread(struct tcb *t_block, int is_affine);
 static void schedule();
 #ifdef RR
 static void sched_rr();
 #else
 static void sched_mlfq();
 void mlfq_all_threads_urgent();
+void mlfq_inherit_priority(struct tcb *waiter);
+void mlfq_restore_priority(struct tcb *owner);
 #endif
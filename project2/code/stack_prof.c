@@ -0,0 +1,73 @@
+#include "stack_prof.h"
+#include <stdint.h>
+#include <string.h>
+
+static stack_routine_prof routines[STACK_PROF_ROUTINES];
+static unsigned long histogram[STACK_PROF_BUCKETS];
+static unsigned long untracked = 0; // threads past the routine table
+
+void stack_prof_fill(void *stack, size_t size) {
+  memset(stack, STACK_CANARY, size);
+}
+
+size_t stack_prof_depth(void *stack, size_t size) {
+  const uint64_t canary = 0x0101010101010101ULL * STACK_CANARY;
+  const uint64_t *word = stack;
+  size_t words = size / sizeof(uint64_t), index = 0;
+
+  // the stack grows down, so the first touched word from the bottom is it
+  while (index < words && word[index] == canary) {
+    index++;
+  }
+  return size - (index * sizeof(uint64_t));
+}
+
+static int stack_prof_bucket(size_t depth) {
+  int bucket = 0;
+  for (size_t limit = 64; depth > limit && bucket < STACK_PROF_BUCKETS - 1;
+       limit <<= 1) {
+    bucket++;
+  }
+  return bucket;
+}
+
+void stack_prof_record(void *routine, size_t depth) {
+  histogram[stack_prof_bucket(depth)]++;
+  for (int i = 0; i < STACK_PROF_ROUTINES; i++) {
+    if (routines[i].routine == NULL) {
+      routines[i].routine = routine;
+    }
+
+    if (routines[i].routine == routine) {
+      routines[i].threads++;
+      routines[i].total_depth += depth;
+
+      if (depth > routines[i].max_depth) {
+        routines[i].max_depth = depth;
+      }
+      return;
+    }
+  }
+  untracked++;
+}
+
+void stack_prof_report(FILE *out, size_t stack_size) {
+  fprintf(out, "stack high-water marks (stack size %zu bytes)\n", stack_size);
+  fprintf(out, "%-18s %10s %10s %10s\n", "routine", "threads", "max", "mean");
+  for (int i = 0; i < STACK_PROF_ROUTINES && routines[i].routine; i++) {
+    fprintf(out, "%-18p %10lu %10zu %10zu\n", routines[i].routine,
+            routines[i].threads, routines[i].max_depth,
+            routines[i].total_depth / routines[i].threads);
+  }
+
+  if (untracked) {
+    fprintf(out, "%lu threads of further routines not tracked\n", untracked);
+  }
+  fprintf(out, "depth histogram\n");
+  size_t limit = 64;
+  for (int bucket = 0; bucket < STACK_PROF_BUCKETS; bucket++, limit <<= 1) {
+    if (histogram[bucket]) {
+      fprintf(out, "  <= %8zu bytes: %lu\n", limit, histogram[bucket]);
+    }
+  }
+}
@@ -0,0 +1,31 @@
+#ifndef STACK_PROF_H
+#define STACK_PROF_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// every byte of an unused stack reads this when profiling (STACK_PROF=1)
+#define STACK_CANARY 0xA5
+#define STACK_PROF_ROUTINES 64
+#define STACK_PROF_BUCKETS 16 // power of two buckets from 64 bytes up
+
+typedef struct stack_routine_prof {
+  void *routine;
+  unsigned long threads;
+  size_t max_depth;
+  size_t total_depth;
+} stack_routine_prof;
+
+/* paints the whole stack with the canary */
+void stack_prof_fill(void *stack, size_t size);
+
+/* deepest point reached, in bytes from the top of the stack */
+size_t stack_prof_depth(void *stack, size_t size);
+
+/* adds one finished thread of routine to the per routine and histogram */
+void stack_prof_record(void *routine, size_t depth);
+
+/* prints the per routine high-water marks and the depth histogram */
+void stack_prof_report(FILE *out, size_t stack_size);
+
+#endif
@@ -5,10 +5,20 @@
 // iLab Server:
 #include "thread-worker.h"
 #include "mutex_types.h"
+#include "stack_prof.h"
+#include "trace.h"
+#include <pthread.h>
 #include <string.h>
+#include <time.h>
 
 #define STACK_SIZE 16 * 1024
 #define QUANTUM 10 * 1000 // 10 ms
+#define RUN_NEXT_LIMIT 4  // back to back "run next" dispatches before a queue
+#define REAP_BATCH 16     // detached exits collected before they are reclaimed
+#define TCB_CACHE_LIMIT 64
+#define RCU_CHECK_INTERVAL 16 // context switches between call_rcu sweeps
+#define GROUP_STRIDE (1UL << 20) // pass charged per quantum used at weight 1
+#define IDLE_WAIT_NS 50 * 1000    // inbox poll interval with nothing ready
 #ifdef MLFQ
 #define LONG_QUANTUM 100 // 100 s
 #endif
@@ -22,56 +32,107 @@ scheduler *t_scheduler;
 
 struct sigaction short_signal;
 struct itimerval short_timer;
-struct sched_queue_t *urgent_p_queue;
 
 #ifdef MLFQ
 struct sigaction long_signal;
 struct itimerval long_timer;
-struct sched_queue_t *high_p_queue, *med_p_queue, *low_p_queue;
 #endif
 
-// should i maintain this?? user responsibility to remove the resource??
+static const struct timespec idle_wait = {0, IDLE_WAIT_NS};
+
+static void swap_run_next();
+static struct sched_group_t *pick_group();
+static void wake_push(struct tcb *t_block, int is_affine);
+static void wake_drain();
+
+// cpu time of the kernel thread at the last dispatch, what ITIMER_PROF counts
+static struct timespec slice_start;
+
+// holds main and every thread created without a group
+static sched_group_t default_group;
+
+// detached threads that exited, reclaimed by the scheduler in batches
 struct sched_queue_t *termination_queue;
+static int termination_cnt = 0;
 
-int init_scheduler_queue() {
-  // Cleanup required
-  if ((urgent_p_queue = (sched_queue_t *)malloc(sizeof(d_list_t))) == NULL) {
-    DEBUG_OUT("Error while allocating memory ");
-    exit(0);
-  }
+// reclaimed tcbs with their stacks, reused by worker_create
+static tcb *tcb_cache = NULL;
+static int tcb_cache_cnt = 0;
+
+// destructors of the thread specific keys, a live key may have none;
+// key_in_use tells which slots are taken
+static void (*key_destructors[WORKER_KEYS_MAX])(void *);
+static int key_in_use[WORKER_KEYS_MAX];
 
+// call_rcu callbacks, oldest grace period first
+static worker_rcu_head *rcu_pending_head = NULL, *rcu_pending_tail = NULL;
+
+// wakeups mutate the ready queues from thread context, a timer tick landing
+// in the middle of one is deferred till the queues are consistent again
+static volatile sig_atomic_t preempt_disabled = 0;
+static volatile sig_atomic_t preempt_pending = 0;
 #ifdef MLFQ
-  if ((high_p_queue = (sched_queue_t *)malloc(sizeof(d_list_t))) == NULL) {
-    DEBUG_OUT("Error while allocating memory ");
-    exit(0);
-  }
+static volatile sig_atomic_t mlfq_boost_pending = 0;
+#endif
 
-  if ((med_p_queue = (sched_queue_t *)malloc(sizeof(d_list_t))) == NULL) {
-    DEBUG_OUT("Error while allocating memory ");
-    exit(0);
+static void preempt_disable() { preempt_disabled++; }
+
+static void preempt_enable() {
+  if (--preempt_disabled == 0 && preempt_pending) {
+    preempt_pending = 0;
+    TRACE_EVENT(PREEMPT_EV, current_worker->t_id);
+    swapcontext(&current_worker->context, scheduler_context_p);
   }
+}
 
-  if ((low_p_queue = (sched_queue_t *)malloc(sizeof(d_list_t))) == NULL) {
+static sched_queue_t *alloc_queue() {
+  sched_queue_t *queue = malloc(sizeof(sched_queue_t));
+  if (queue == NULL) {
     DEBUG_OUT("Error while allocating memory ");
     exit(0);
   }
+  queue->head = queue->tail = NULL;
+  return queue;
+}
+
+static void init_group(sched_group_t *group, int weight) {
+  group->weight = weight;
+  group->stride = GROUP_STRIDE / weight;
+  group->pass = 0;
+  group->threads = 0;
+  group->urgent_p_queue = alloc_queue();
+#ifdef MLFQ
+  group->high_p_queue = alloc_queue();
+  group->med_p_queue = alloc_queue();
+  group->low_p_queue = alloc_queue();
+#else
+  group->high_p_queue = group->med_p_queue = group->low_p_queue = NULL;
 #endif
+  group->next = NULL;
+}
+
+int init_scheduler_queue() {
+  init_group(&default_group, GROUP_WEIGHT_DEFAULT);
+  termination_queue = alloc_queue();
   return SUCCESS_WCS;
 }
 
 // can use variadic args(?) to avoid callee, arg1, arg2, ...
-int create_context(ucontext_t *context, void *thread_func, int argv,
-                   void *callee, void *arg) {
+// a recycled stack can be passed in, a new one is allocated for NULL
+int create_context(ucontext_t *context, void *stack, void *thread_func,
+                   int argv, void *callee, void *arg) {
   if (getcontext(context) < 0) {
     DEBUG_OUT("Getcontext failed for scheduler");
     exit(FAILED_WCS);
   }
 
-  void *stack;
-  if ((stack = malloc(STACK_SIZE)) == NULL) {
+  if (stack == NULL && (stack = malloc(STACK_SIZE)) == NULL) {
     DEBUG_OUT("Error while allocating memory ");
     exit(MALLOC_FAILURE_WCS);
   }
+#ifdef STACK_PROFILE
+  stack_prof_fill(stack, STACK_SIZE);
+#endif
   context->uc_link = NULL;
   context->uc_stack.ss_sp = stack;
   context->uc_stack.ss_size = STACK_SIZE;
@@ -88,7 +149,20 @@ int init_main_context() {
   }
   tcb *thread_block = malloc(sizeof(tcb));
   thread_block->context = main_context;
-  thread_block->priority = URGENT_PRIORITY_T;
+  thread_block->priority = thread_block->base_priority = URGENT_PRIORITY_T;
+  thread_block->held = NULL;
+  thread_block->blocked_on = NULL;
+  thread_block->joiner = NULL;
+  thread_block->is_detached = 0;
+  thread_block->wake_next = NULL;
+  thread_block->wake_affine = thread_block->parked = thread_block->permit = 0;
+  thread_block->batch = NULL;
+  thread_block->group = &default_group;
+  default_group.threads++;
+  thread_block->rcu_nesting = 0;
+  thread_block->rcu_qs_seq = 0;
+  memset(thread_block->specific, 0, sizeof(thread_block->specific));
+  thread_block->stack = thread_block->start_routine = NULL; // runs on main's
   thread_block->status = READY_T;
 
   // to add the thread to main queue during swap context
@@ -109,6 +183,7 @@ int init_scheduler() {
   }
   DEBUG_OUT("STARTING SCHEDULER...");
   init_scheduler_queue();
+  TRACE_THREAD_INIT(); // the ring of this kernel thread, before any tick
 
   // configuring signal handler for the scheduler
   // additional timer for changing all threads to common queue still pending...
@@ -131,9 +206,17 @@ int init_scheduler() {
     DEBUG_OUT("Error while allocating scheduler memory ");
     exit(0);
   }
+  t_scheduler->run_next = NULL;
+  t_scheduler->run_next_streak = 0;
+  t_scheduler->ctx_switches = 0;
+  t_scheduler->wake_inbox = NULL;
+  t_scheduler->parked_cnt = 0;
+  t_scheduler->groups = &default_group;
+  t_scheduler->group_pass = 0;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &slice_start);
 
   // creating scheduler context
-  create_context(scheduler_context_p, (void *)&schedule, 0, NULL, NULL);
+  create_context(scheduler_context_p, NULL, (void *)&schedule, 0, NULL, NULL);
 
   // creating and starting main thread context
   init_main_context();
@@ -141,38 +224,245 @@ int init_scheduler() {
   return SUCCESS_WCS;
 }
 
+// same as pthreads, a destructor setting a value again gets a few more rounds
+static void run_key_destructors() {
+  for (int round = 0; round < WORKER_KEY_DESTRUCTOR_ROUNDS; round++) {
+    int is_called = 0;
+    for (int key = 0; key < WORKER_KEYS_MAX; key++) {
+      void *value = current_worker->specific[key];
+
+      if (value && key_in_use[key] && key_destructors[key]) {
+        current_worker->specific[key] = NULL;
+        key_destructors[key](value);
+        is_called = 1;
+      }
+    }
+
+    if (!is_called) {
+      return;
+    }
+  }
+}
+
 void run_thread(void(*func(void *)), void *arg) {
   DEBUG_OUT_ARG("Executing thread...", current_worker->t_id);
   current_worker->status = RUNNING_T;
-  func(arg);
+  current_worker->ret_val = func(arg);
+  run_key_destructors();
   current_worker->status = TERMINATING_T;
   DEBUG_OUT_ARG("Terminating thread...", current_worker->t_id);
   setcontext(scheduler_context_p);
 }
 
+void cache_tcb(tcb *t_block) {
+#ifdef STACK_PROFILE
+  size_t depth = stack_prof_depth(t_block->stack, STACK_SIZE);
+  DEBUG_OUT_ARG("Stack high-water mark", (int)depth);
+  stack_prof_record(t_block->start_routine, depth);
+#endif
+
+  // batched tcbs and stacks share one block, freed with the last of them
+  if (t_block->batch) {
+    if (--t_block->batch->unreaped == 0) {
+      free(t_block->batch);
+    }
+    return;
+  }
+
+  if (tcb_cache_cnt >= TCB_CACHE_LIMIT) {
+    free(t_block->stack);
+    free(t_block);
+    return;
+  }
+  t_block->next_cached = tcb_cache;
+  tcb_cache = t_block;
+  tcb_cache_cnt++;
+}
+
+// called with preemption disabled, the exited threads' stacks are idle
+void reap_threads() {
+  DEBUG_OUT_ARG("Reaping detached threads", termination_cnt);
+  while (termination_queue->head) {
+    tcb *t_block = queue_t_dequeue(termination_queue);
+    list_del_node((list_node_t *)t_block->t_id, &t_scheduler->thread_blocks);
+    cache_tcb(t_block);
+  }
+  termination_cnt = 0;
+}
+
+int worker_group_create(worker_group_t *group, int weight) {
+  if (weight < 1 || weight > GROUP_WEIGHT_MAX) {
+    return FAILED_WCS;
+  }
+  init_scheduler();
+
+  sched_group_t *new_group = malloc(sizeof(sched_group_t));
+  if (new_group == NULL) {
+    DEBUG_OUT("Error while allocating memory ");
+    exit(MALLOC_FAILURE_WCS);
+  }
+  init_group(new_group, weight);
+
+  preempt_disable(); // the scheduler walks the group list
+  new_group->pass = t_scheduler->group_pass;
+  new_group->next = default_group.next;
+  default_group.next = new_group;
+  preempt_enable();
+  *group = new_group;
+  return SUCCESS_WCS;
+}
+
+// only an empty group can go, its threads would be left without queues
+int worker_group_destroy(worker_group_t group) {
+  if (group == NULL || group == &default_group || group->threads) {
+    return FAILED_WCS;
+  }
+  preempt_disable();
+  sched_group_t *prev = &default_group;
+  while (prev->next && prev->next != group) {
+    prev = prev->next;
+  }
+
+  if (prev->next == NULL) {
+    preempt_enable();
+    return FAILED_WCS;
+  }
+  prev->next = group->next;
+  free(group->urgent_p_queue);
+  free(group->high_p_queue);
+  free(group->med_p_queue);
+  free(group->low_p_queue);
+  free(group);
+  preempt_enable();
+  return SUCCESS_WCS;
+}
+
 int worker_create(worker_t *thread, pthread_attr_t *attr,
                   void *(*function)(void *), void *arg) {
-  init_scheduler();
+  return worker_create_grouped(thread, NULL, attr, function, arg);
+}
 
-  if (t_scheduler->thread_blocks->length >= MAX_THREAD_COUNT) {
-    return LIMIT_REACHED_WCS;
+// a NULL group puts the new thread in its creator's group
+// fills a tcb whose stack is already set, and puts it in the thread list
+static void init_tcb(tcb *thread_block, void *stack, pthread_attr_t *attr,
+                     void *(*function)(void *), void *arg,
+                     worker_group_t group) {
+  // arg is always passed, a NULL one still has to reach the function as NULL
+  create_context(&thread_block->context, stack, &run_thread, 2, function, arg);
+  thread_block->priority = thread_block->base_priority = URGENT_PRIORITY_T;
+  thread_block->held = NULL;
+  thread_block->blocked_on = NULL;
+  thread_block->joiner = NULL;
+  thread_block->is_detached = 0;
+
+  if (attr) {
+    int detach_state;
+    pthread_attr_getdetachstate(attr, &detach_state);
+    thread_block->is_detached = detach_state == PTHREAD_CREATE_DETACHED;
   }
-  tcb *thread_block = malloc(sizeof(tcb));
-  int argv = arg == NULL ? 1 : 2;
-  create_context(&thread_block->context, &run_thread, argv, function, arg);
-  thread_block->priority = URGENT_PRIORITY_T;
+  thread_block->wake_next = NULL;
+  thread_block->wake_affine = thread_block->parked = thread_block->permit = 0;
+  thread_block->batch = NULL;
+  thread_block->rcu_nesting = 0;
+  thread_block->rcu_qs_seq = 0;
+  memset(thread_block->specific, 0, sizeof(thread_block->specific));
+  thread_block->group = group ? group : current_worker->group;
+  thread_block->group->threads++;
+  thread_block->start_routine = function;
   thread_block->stack = thread_block->context.uc_stack.ss_sp;
   thread_block->status = READY_T;
   struct list_node_t *node =
       list_add_tail(thread_block, &t_scheduler->thread_blocks);
   thread_block->is_yield = thread_block->yield_cnt = 0;
   thread_block->t_id = (void *)node;
+}
+
+// called with preemption disabled, makes room for count more threads
+static int reserve_threads(int count) {
+  if (t_scheduler->thread_blocks->length + count > MAX_THREAD_COUNT &&
+      termination_cnt) {
+    reap_threads();
+  }
+  return t_scheduler->thread_blocks->length + count <= MAX_THREAD_COUNT;
+}
+
+int worker_create_grouped(worker_t *thread, worker_group_t group,
+                          pthread_attr_t *attr, void *(*function)(void *),
+                          void *arg) {
+  init_scheduler();
+  preempt_disable(); // heap and thread list are shared with the scheduler
+
+  if (!reserve_threads(1)) {
+    preempt_enable();
+    return LIMIT_REACHED_WCS;
+  }
+  tcb *thread_block = tcb_cache;
+  void *stack = NULL;
+
+  if (thread_block) {
+    tcb_cache = thread_block->next_cached;
+    tcb_cache_cnt--;
+    stack = thread_block->stack;
+  } else {
+    thread_block = malloc(sizeof(tcb));
+  }
+  init_tcb(thread_block, stack, attr, function, arg, group);
   (*thread) = thread_block->t_id;
-  queue_t_enqueue(thread_block, urgent_p_queue);
-  DEBUG_OUT_ARG("Created user thread", node->t_block->t_id);
+  queue_t_enqueue(thread_block, thread_block->group->urgent_p_queue);
+  preempt_enable();
+  DEBUG_OUT_ARG("Created user thread", thread_block->t_id);
   return SUCCESS_WCS;
 }
 
+/*
+ * n threads running function(args[i]) (NULL args: all get NULL). The batch
+ * header, the tcbs and the stacks come from one allocation that is released
+ * once every thread of the batch has been joined or reaped.
+ */
+int worker_create_n(worker_t *threads, int n, pthread_attr_t *attr,
+                    void *(*function)(void *), void **args) {
+  if (n < 1) {
+    return FAILED_WCS;
+  }
+  init_scheduler();
+  preempt_disable();
+
+  if (!reserve_threads(n)) {
+    preempt_enable();
+    return LIMIT_REACHED_WCS;
+  }
+  size_t header_size = (sizeof(worker_batch_t) + 15) & ~15UL;
+  size_t tcbs_size = (n * sizeof(tcb) + 15) & ~15UL;
+  char *block = malloc(header_size + tcbs_size + (size_t)n * STACK_SIZE);
+
+  if (block == NULL) {
+    DEBUG_OUT("Error while allocating memory ");
+    exit(MALLOC_FAILURE_WCS);
+  }
+  worker_batch_t *batch = (worker_batch_t *)block;
+  tcb *thread_blocks = (tcb *)(block + header_size);
+  char *stacks = block + header_size + tcbs_size;
+  batch->running = batch->unreaped = n;
+  batch->joiner = NULL;
+
+  // queued privately first, the scheduler sees the batch in one splice
+  sched_queue_t ready = {NULL, NULL};
+  for (int i = 0; i < n; i++) {
+    tcb *thread_block = &thread_blocks[i];
+    init_tcb(thread_block, stacks + (size_t)i * STACK_SIZE, attr, function,
+             args ? args[i] : NULL, NULL);
+    thread_block->batch = batch;
+    threads[i] = thread_block->t_id;
+    queue_t_enqueue(thread_block, &ready);
+  }
+  queue_t_splice(&ready, current_worker->group->urgent_p_queue);
+  preempt_enable();
+  DEBUG_OUT_ARG("Created user thread batch", n);
+  return SUCCESS_WCS;
+}
+
+worker_t worker_self() { return current_worker ? current_worker->t_id : 0; }
+
 int worker_yield() {
   if (!is_init_scheduler) {
     DEBUG_OUT("Invoking yield when scheduler was not inited");
@@ -180,33 +470,327 @@ int worker_yield() {
   }
   current_worker->is_yield = 1;
   current_worker->yield_cnt++;
+  TRACE_EVENT(YIELD_EV, current_worker->t_id);
   swapcontext(&current_worker->context, scheduler_context_p);
   return SUCCESS_WCS;
 };
 
 void worker_exit(void *value_ptr) {
   current_worker->ret_val = value_ptr;
+  run_key_destructors();
   current_worker->status = TERMINATING_T;
   setcontext(scheduler_context_p);
 }
 
+int worker_detach(worker_t thread) {
+  struct list_node_t *node = (void *)thread;
+
+  if (node->t_block->is_detached || node->t_block->joiner) {
+    return INVALID_THREAD_WCS;
+  }
+  preempt_disable();
+  node->t_block->is_detached = 1;
+
+  // already gone, nobody else will hand it to the reaper
+  if (node->t_block->status & TERMINATING_T) {
+    queue_t_enqueue(node->t_block, termination_queue);
+    termination_cnt++;
+  }
+  preempt_enable();
+  return SUCCESS_WCS;
+}
+
 int worker_join(worker_t thread, void **value_ptr) {
   DEBUG_OUT_ARG("Join worker thread", thread);
   struct list_node_t *node = (void *)thread;
 
-  while (node->t_block->status & ~TERMINATING_T)
-    ;
+  if (node->t_block->is_detached) {
+    return INVALID_THREAD_WCS;
+  }
+
+  // sleep till the scheduler wakes us on the thread's exit; no tick may
+  // switch us out between publishing the joiner and checking the status
+  preempt_disable();
+  node->t_block->joiner = current_worker;
+
+  if (!(node->t_block->status & TERMINATING_T)) {
+    current_worker->status = WAITING_T;
+    preempt_disabled = preempt_pending = 0; // switching out anyway
+    TRACE_EVENT(BLOCK_EV, current_worker->t_id);
+    swapcontext(&current_worker->context, scheduler_context_p);
+    preempt_disable();
+  }
 
   if (value_ptr) {
     (*value_ptr) = node->t_block->ret_val;
   }
   DEBUG_OUT_ARG("Terminating user thread", node->t_block->t_id);
-  free(node->t_block->stack);
-  free(node->t_block);
+  cache_tcb(node->t_block);
   list_del_node(node, &t_scheduler->thread_blocks);
-  return 0;
+  preempt_enable();
+  return SUCCESS_WCS;
 };
 
+/*
+ * Joins threads from one worker_create_n() call with a single sleep, the
+ * last of the batch to exit wakes the caller. Any other set of threads is
+ * joined one by one.
+ */
+int worker_join_all(worker_t *threads, int n, void **value_ptrs) {
+  worker_batch_t *batch = n > 0 ? ((list_node_t *)threads[0])->t_block->batch
+                                : NULL;
+
+  for (int i = 0; batch && i < n; i++) {
+    tcb *t_block = ((list_node_t *)threads[i])->t_block;
+    if (t_block->batch != batch || t_block->is_detached) {
+      batch = NULL;
+    }
+  }
+
+  if (batch == NULL) {
+    int ret = SUCCESS_WCS;
+    for (int i = 0; i < n; i++) {
+      if (worker_join(threads[i], value_ptrs ? &value_ptrs[i] : NULL) !=
+          SUCCESS_WCS) {
+        ret = INVALID_THREAD_WCS;
+      }
+    }
+    return ret;
+  }
+
+  preempt_disable();
+  if (batch->running) {
+    batch->joiner = current_worker;
+    current_worker->status = WAITING_T;
+    preempt_disabled = preempt_pending = 0; // switching out anyway
+    TRACE_EVENT(BLOCK_EV, current_worker->t_id);
+    swapcontext(&current_worker->context, scheduler_context_p);
+    preempt_disable();
+  }
+  batch->joiner = NULL;
+
+  // the last cache_tcb frees the batch block, nothing is read after it
+  for (int i = 0; i < n; i++) {
+    list_node_t *node = (list_node_t *)threads[i];
+
+    if (value_ptrs) {
+      value_ptrs[i] = node->t_block->ret_val;
+    }
+    cache_tcb(node->t_block);
+    list_del_node(node, &t_scheduler->thread_blocks);
+  }
+  preempt_enable();
+  return SUCCESS_WCS;
+}
+
+/*
+ * Blocks till a permit is available. worker_unpark() leaves one, so an
+ * unpark that comes first makes the next park return at once.
+ */
+void worker_park() {
+  preempt_disable();
+  if (__atomic_exchange_n(&current_worker->permit, 0, __ATOMIC_ACQUIRE)) {
+    preempt_enable();
+    return;
+  }
+  current_worker->status = WAITING_T;
+  __atomic_store_n(&current_worker->parked, 1, __ATOMIC_SEQ_CST);
+
+  // an unpark landing between the check and parked = 1 left a permit
+  if (__atomic_exchange_n(&current_worker->permit, 0, __ATOMIC_SEQ_CST) &&
+      __atomic_exchange_n(&current_worker->parked, 0, __ATOMIC_SEQ_CST)) {
+    current_worker->status = RUNNING_T;
+    preempt_enable();
+    return;
+  }
+  t_scheduler->parked_cnt++;
+  preempt_disabled = preempt_pending = 0; // switching out anyway
+  TRACE_EVENT(BLOCK_EV, current_worker->t_id);
+  swapcontext(&current_worker->context, scheduler_context_p);
+
+  // the permit of the unpark that woke us
+  __atomic_store_n(&current_worker->permit, 0, __ATOMIC_RELEASE);
+  preempt_disable();
+  t_scheduler->parked_cnt--;
+  preempt_enable();
+}
+
+// safe from other pthreads and from signal handlers
+int worker_unpark(worker_t thread) {
+  tcb *t_block = ((list_node_t *)thread)->t_block;
+
+  __atomic_store_n(&t_block->permit, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_exchange_n(&t_block->parked, 0, __ATOMIC_SEQ_CST)) {
+    wake_push(t_block, 0);
+  }
+  return SUCCESS_WCS;
+}
+
+int worker_trace_dump(const char *path) { return trace_dump(path); }
+
+size_t worker_stack_usage(worker_t thread) {
+#ifdef STACK_PROFILE
+  struct list_node_t *node = (void *)thread;
+
+  if (node->t_block->stack) {
+    return stack_prof_depth(node->t_block->stack, STACK_SIZE);
+  }
+#else
+  (void)thread;
+#endif
+  return 0;
+}
+
+void worker_stack_report(FILE *out) {
+#ifdef STACK_PROFILE
+  preempt_disable();
+  stack_prof_report(out, STACK_SIZE);
+  preempt_enable();
+#else
+  fprintf(out, "stack profiling is off, build with STACK_PROF=1\n");
+#endif
+}
+
+int worker_key_create(worker_key_t *key, void (*destructor)(void *)) {
+  preempt_disable();
+  for (int index = 0; index < WORKER_KEYS_MAX; index++) {
+    if (!key_in_use[index]) {
+      key_in_use[index] = 1;
+      key_destructors[index] = destructor;
+      *key = index;
+      preempt_enable();
+      return SUCCESS_WCS;
+    }
+  }
+  preempt_enable();
+  return LIMIT_REACHED_WCS;
+}
+
+int worker_key_delete(worker_key_t key) {
+  if (key >= WORKER_KEYS_MAX || !key_in_use[key]) {
+    return FAILED_WCS;
+  }
+  preempt_disable();
+  key_in_use[key] = 0;
+  key_destructors[key] = NULL;
+
+  // a recreated key must read back NULL everywhere
+  if (is_init_scheduler) {
+    list_node_t *node = t_scheduler->thread_blocks->head;
+    for (int i = 0; i < t_scheduler->thread_blocks->length;
+         i++, node = node->next) {
+      node->t_block->specific[key] = NULL;
+    }
+  }
+  preempt_enable();
+  return SUCCESS_WCS;
+}
+
+int worker_setspecific(worker_key_t key, const void *value) {
+  if (key >= WORKER_KEYS_MAX || !key_in_use[key]) {
+    return FAILED_WCS;
+  }
+  init_scheduler();
+  current_worker->specific[key] = (void *)value;
+  return SUCCESS_WCS;
+}
+
+void *worker_getspecific(worker_key_t key) {
+  if (current_worker == NULL || key >= WORKER_KEYS_MAX) {
+    return NULL;
+  }
+  return current_worker->specific[key];
+}
+
+/*
+ * Quiescent-state RCU. Readers only bump a counter in their own tcb; a
+ * thread switched out with no read section open has passed a quiescent
+ * state, and the scheduler stamps it with its context switch count. A grace
+ * period that began at switch `seq` is over once no thread is still inside a
+ * read section it entered before then.
+ */
+void worker_rcu_read_lock() {
+  if (current_worker) {
+    current_worker->rcu_nesting++;
+  }
+  __asm__ __volatile__("" ::: "memory");
+}
+
+void worker_rcu_read_unlock() {
+  __asm__ __volatile__("" ::: "memory");
+  if (current_worker) {
+    current_worker->rcu_nesting--;
+  }
+}
+
+// called with preemption disabled, skip is the thread asking (if any)
+static int rcu_gp_done(unsigned long seq, tcb *skip) {
+  list_node_t *node = t_scheduler->thread_blocks->head;
+  for (int i = 0; i < t_scheduler->thread_blocks->length;
+       i++, node = node->next) {
+    tcb *t_block = node->t_block;
+
+    if (t_block == skip || (t_block->status & TERMINATING_T)) {
+      continue;
+    }
+
+    if (t_block->rcu_nesting > 0 && t_block->rcu_qs_seq <= seq) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+void worker_synchronize_rcu() {
+  if (!is_init_scheduler) {
+    return; // only the caller exists, there can be no readers
+  }
+  preempt_disable();
+  unsigned long seq = t_scheduler->ctx_switches;
+  while (!rcu_gp_done(seq, current_worker)) {
+    preempt_enable();
+    worker_yield();
+    preempt_disable();
+  }
+  preempt_enable();
+}
+
+void worker_call_rcu(worker_rcu_head *head, void (*func)(worker_rcu_head *)) {
+  head->func = func;
+  head->next = NULL;
+
+  if (!is_init_scheduler) {
+    func(head);
+    return;
+  }
+  preempt_disable();
+  head->gp_seq = t_scheduler->ctx_switches;
+
+  if (rcu_pending_tail) {
+    rcu_pending_tail->next = head;
+  } else {
+    rcu_pending_head = head;
+  }
+  rcu_pending_tail = head;
+  preempt_enable();
+}
+
+// runs from the scheduler, callbacks must not block
+static void rcu_process_callbacks() {
+  while (rcu_pending_head && rcu_gp_done(rcu_pending_head->gp_seq, NULL)) {
+    unsigned long seq = rcu_pending_head->gp_seq;
+    while (rcu_pending_head && rcu_pending_head->gp_seq == seq) {
+      worker_rcu_head *head = rcu_pending_head;
+      rcu_pending_head = head->next;
+      head->func(head);
+    }
+  }
+
+  if (rcu_pending_head == NULL) {
+    rcu_pending_tail = NULL;
+  }
+}
+
 /* initialize the mutex lock */
 int worker_mutex_init(worker_mutex_t *mutex,
                       const pthread_mutexattr_t *mutexattr) {
@@ -219,62 +803,177 @@ int worker_mutex_init(worker_mutex_t *mutex,
   }
   mutex->block_list->head = mutex->block_list->tail = NULL;
   mutex->block_list->length = 0;
+  mutex->owner = NULL;
+  mutex->held_next = NULL;
   return 0;
 };
 
+// the owner's held list is what its priority is recomputed from at unlock
+static void mutex_take(worker_mutex_t *mutex) {
+  mutex->owner = current_worker;
+
+  if (current_worker == NULL) {
+    return; // locked before the first worker_create
+  }
+  preempt_disable();
+  mutex->held_next = current_worker->held;
+  current_worker->held = mutex;
+  preempt_enable();
+}
+
+int worker_mutex_trylock(worker_mutex_t *mutex) {
+  if (__atomic_test_and_set(&mutex->mutex_lock, LOCKED_T) == 0) {
+    mutex_take(mutex);
+    return 0;
+  }
+  return LOCKED_T;
+}
+
 /* aquire the mutex lock */
 int worker_mutex_lock(worker_mutex_t *mutex) {
   while (1) {
     if (__atomic_test_and_set(&mutex->mutex_lock, LOCKED_T) == 0) {
+      mutex_take(mutex);
       DEBUG_OUT("Mutex lock has been acquired");
       return 0;
     }
 
     while (__atomic_test_and_set(&mutex->list_lock, LOCKED_T) == 1) {
     };
+    preempt_disable();
     current_worker->status = WAITING_T; // Adding worker to block list
+    current_worker->blocked_on = mutex; // owner inherits our priority (MLFQ)
     list_add_tail(current_worker, &mutex->block_list);
     __sync_lock_release(&mutex->list_lock);
+    preempt_disabled = preempt_pending = 0; // switching out anyway
+    TRACE_EVENT(BLOCK_EV, current_worker->t_id);
     swapcontext(&current_worker->context, scheduler_context_p);
+    current_worker->blocked_on = NULL;
   }
 };
 
-void enqueue_blocked_nodes(list_node_t *node) {
-  node->t_block->status = READY_T;
+sched_queue_t *group_queue(sched_group_t *group, priority_t priority) {
 #ifdef MLFQ
-  switch (node->t_block->priority) {
-  case URGENT_PRIORITY_T:
-    queue_t_enqueue(node->t_block, urgent_p_queue);
-    break;
+  switch (priority) {
   case HIGH_PRIORITY_T:
-    queue_t_enqueue(node->t_block, high_p_queue);
-    break;
+    return group->high_p_queue;
   case MEDIUM_PRIORITY_T:
-    queue_t_enqueue(node->t_block, med_p_queue);
-    break;
+    return group->med_p_queue;
   case LOW_PRIORITY_T:
-    queue_t_enqueue(node->t_block, low_p_queue);
-    break;
+    return group->low_p_queue;
   default:
-    queue_t_enqueue(node->t_block, urgent_p_queue);
+    return group->urgent_p_queue;
   }
 #else
   // Added only to urgent queue by default for RR
-  queue_t_enqueue(node->t_block, urgent_p_queue);
+  (void)priority;
+  return group->urgent_p_queue;
 #endif
 }
 
+void enqueue_ready(tcb *t_block) {
+  t_block->status = READY_T;
+  queue_t_enqueue(t_block, group_queue(t_block->group, t_block->priority));
+}
+
+/*
+ * Wakeup inbox: a lock free stack anyone may push to, other pthreads and
+ * signal handlers included, and only the scheduler drains. Thread context
+ * never touches the ready queues to wake a thread.
+ */
+static void wake_push(tcb *t_block, int is_affine) {
+  t_block->wake_affine = is_affine;
+  tcb *head = __atomic_load_n(&t_scheduler->wake_inbox, __ATOMIC_RELAXED);
+  do {
+    t_block->wake_next = head;
+  } while (!__atomic_compare_exchange_n(&t_scheduler->wake_inbox, &head,
+                                        t_block, 1, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED));
+}
+
+// scheduler only, wakes the pushed threads in the order they were pushed
+static void wake_drain() {
+  tcb *t_block =
+      __atomic_exchange_n(&t_scheduler->wake_inbox, NULL, __ATOMIC_ACQUIRE);
+  tcb *fifo = NULL;
+
+  while (t_block) {
+    tcb *next = t_block->wake_next;
+    t_block->wake_next = fifo;
+    fifo = t_block;
+    t_block = next;
+  }
+
+  while (fifo) {
+    t_block = fifo;
+    fifo = fifo->wake_next;
+    t_block->wake_next = NULL;
+
+    // woken before the scheduler got to it, the policy queues it as a yield
+    if (t_block == current_worker) {
+      t_block->status = READY_T;
+      t_block->is_yield = 1;
+      continue;
+    }
+    wake_thread(t_block, t_block->wake_affine);
+  }
+}
+
+/*
+ * Wake-affine hand-off: the thread woken by an unlock or an exit claims the
+ * scheduler's "run next" slot so it runs while the waker's data is still hot.
+ * The slot is LIFO, a newer claim pushes the older one back to its queue.
+ */
+void wake_thread(tcb *t_block, int is_affine) {
+  TRACE_EVENT(WAKE_EV, t_block->t_id);
+
+  if (!is_affine) {
+    enqueue_ready(t_block);
+    return;
+  }
+
+  if (t_scheduler->run_next) {
+    enqueue_ready(t_scheduler->run_next);
+  }
+  t_block->status = READY_T;
+  t_scheduler->run_next = t_block;
+}
+
 int worker_mutex_unlock(worker_mutex_t *mutex) {
   while (__atomic_test_and_set(&mutex->list_lock, LOCKED_T) == 1) {
   };
   DEBUG_OUT("Mutex unlock invoked");
+  int is_affine = 1; // the lock is handed to the longest waiter first
+  preempt_disable();
+  tcb *owner = mutex->owner;
+
+  if (owner) {
+    worker_mutex_t **link = &owner->held;
+    while (*link && *link != mutex) {
+      link = &(*link)->held_next;
+    }
+
+    if (*link) {
+      *link = mutex->held_next;
+    }
+  }
+  mutex->owner = NULL;
+  mutex->held_next = NULL;
+#ifdef MLFQ
+  // whatever the waiters of this mutex lent is given back
+  if (owner) {
+    mlfq_restore_priority(owner);
+  }
+#endif
   while (mutex->block_list->length) {
     list_node_t *node = mutex->block_list->head;
-    enqueue_blocked_nodes(node);
+    wake_push(node->t_block, is_affine);
     list_del_node(node, &mutex->block_list);
+    is_affine = 0;
   }
   __sync_lock_release(&mutex->list_lock);
   __sync_lock_release(&mutex->mutex_lock);
+  preempt_enable();
   return 0;
 };
 
@@ -293,71 +992,207 @@ void move_threads_urgent(sched_queue_t *queue) {
   if (queue->head) {
     while (queue->head) {
       tcb *thread_block = queue_t_dequeue(queue);
-      thread_block->priority = URGENT_PRIORITY_T;
-      queue_t_enqueue(thread_block, urgent_p_queue);
+      thread_block->priority = thread_block->base_priority = URGENT_PRIORITY_T;
+      queue_t_enqueue(thread_block, thread_block->group->urgent_p_queue);
     }
   }
 }
 
+// invoked from the scheduler context once the long alarm has gone off
 void mlfq_all_threads_urgent() {
-  // timer stopped temporarily till the threads are moved to urgent queue
-  short_timer.it_value.tv_usec = 0;
-  short_timer.it_value.tv_sec = 0;
-  setitimer(ITIMER_PROF, &short_timer, NULL);
-  move_threads_urgent(high_p_queue);
-  move_threads_urgent(med_p_queue);
-  move_threads_urgent(low_p_queue);
-
-  // Timer configured to continue switching...
-  swapcontext(&current_worker->context, scheduler_context_p);
+  mlfq_boost_pending = 0;
+  for (sched_group_t *group = t_scheduler->groups; group;
+       group = group->next) {
+    move_threads_urgent(group->high_p_queue);
+    move_threads_urgent(group->med_p_queue);
+    move_threads_urgent(group->low_p_queue);
+  }
 }
 #endif
 
 void timer_sig_handler(int signum) {
-#ifdef RR
-  swapcontext(&current_worker->context, scheduler_context_p);
-#else
-  if (signum == SIGPROF) {
-    swapcontext(&current_worker->context, scheduler_context_p);
-  } else if (signum == SIGVTALRM) {
+#ifdef MLFQ
+  if (signum == SIGVTALRM) {
     DEBUG_OUT("MLFQ long alarm called, making all threads urgent");
-    mlfq_all_threads_urgent();
+    mlfq_boost_pending = 1;
   }
 #endif
+
+  if (preempt_disabled) {
+    preempt_pending = 1;
+    return;
+  }
+  TRACE_EVENT(PREEMPT_EV, current_worker->t_id);
+  swapcontext(&current_worker->context, scheduler_context_p);
+}
+
+// the group pays for the part of a quantum its thread actually ran, so one
+// that yields early is not charged a whole stride
+static void charge_group(sched_group_t *group) {
+  struct timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  unsigned long long used_us = (now.tv_sec - slice_start.tv_sec) * 1000000ULL +
+                               (now.tv_nsec - slice_start.tv_nsec) / 1000;
+  group->pass += (unsigned long)(group->stride * used_us / (QUANTUM));
 }
 
 /* scheduler */
 static void schedule() {
+  preempt_disabled = 1; // a stale tick must not preempt the scheduler itself
+  t_scheduler->ctx_switches++;
+  charge_group(current_worker->group);
+
+  if (current_worker->rcu_nesting == 0) {
+    current_worker->rcu_qs_seq = t_scheduler->ctx_switches;
+  }
+
+  if (rcu_pending_head &&
+      (t_scheduler->ctx_switches % RCU_CHECK_INTERVAL) == 0) {
+    rcu_process_callbacks();
+  }
+
+  if (t_scheduler->wake_inbox) {
+    wake_drain();
+  }
+
+  if (current_worker->status & TERMINATING_T) {
+    TRACE_EVENT(EXIT_EV, current_worker->t_id);
+
+    // reaped before the exiting thread is queued, it is still current_worker
+    if (current_worker->is_detached) {
+      if (termination_cnt >= REAP_BATCH) {
+        reap_threads();
+      }
+      queue_t_enqueue(current_worker, termination_queue);
+      termination_cnt++;
+    }
+
+    if (current_worker->joiner &&
+        (current_worker->joiner->status & WAITING_T)) {
+      wake_thread(current_worker->joiner, 1);
+    }
+
+    worker_batch_t *batch = current_worker->batch;
+    if (batch && --batch->running == 0 && batch->joiner &&
+        (batch->joiner->status & WAITING_T)) {
+      wake_thread(batch->joiner, 1);
+    }
+    current_worker->group->threads--;
+  }
+
+  while (1) {
 #ifndef MLFQ
-  sched_rr();
+    sched_rr();
 #else
-  sched_mlfq();
+    sched_mlfq();
 #endif
+    // nothing was ready; a parked thread can still be woken from outside
+    if (t_scheduler->parked_cnt == 0) {
+      return;
+    }
+    while (__atomic_load_n(&t_scheduler->wake_inbox, __ATOMIC_ACQUIRE) ==
+           NULL) {
+      nanosleep(&idle_wait, NULL);
+    }
+    wake_drain();
+  }
+}
+
+static void dispatch_thread(tcb *t_block) {
+  current_worker = t_block;
+  current_worker->status = RUNNING_T;
+
+  // every slice is charged to the group once it ends, run next hand-offs
+  // included, see charge_group
+  sched_group_t *group = t_block->group;
+  if (group->pass < t_scheduler->group_pass) {
+    group->pass = t_scheduler->group_pass;
+  }
+  t_scheduler->group_pass = group->pass;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &slice_start);
+
+  // Configure the timer to expire after the quantum time slice
+  short_timer.it_value.tv_usec = QUANTUM;
+  short_timer.it_value.tv_sec = 0;
+  setitimer(ITIMER_PROF, &short_timer, NULL);
+  preempt_disabled = preempt_pending = 0;
+
+  // swap to the thread
+  DEBUG_OUT_ARG("Swapping threads...", current_worker->t_id);
+  TRACE_EVENT(DISPATCH_EV, current_worker->t_id);
+  setcontext(&current_worker->context);
 }
 
 static void swap_threads(struct sched_queue_t **queue) {
   if ((*queue)->head) {
     // dequeue the head and schedule the thread
-    current_worker = queue_t_dequeue(*queue);
-    current_worker->status = RUNNING_T;
+    t_scheduler->run_next_streak = 0;
+    dispatch_thread(queue_t_dequeue(*queue));
+  }
+}
 
-    // Configure the timer to expire after the quantum time slice
-    short_timer.it_value.tv_usec = QUANTUM;
-    short_timer.it_value.tv_sec = 0;
-    setitimer(ITIMER_PROF, &short_timer, NULL);
+// runs the woken thread parked in the "run next" slot, unless it has already
+// jumped the queues RUN_NEXT_LIMIT times in a row
+static void swap_run_next() {
+  tcb *t_block = t_scheduler->run_next;
 
-    // swap to the thread
-    DEBUG_OUT_ARG("Swapping threads...", current_worker->t_id);
-    setcontext(&current_worker->context);
+  if (t_block == NULL) {
+    return;
   }
+  t_scheduler->run_next = NULL;
+
+  if (t_scheduler->run_next_streak >= RUN_NEXT_LIMIT) {
+    enqueue_ready(t_block);
+    return;
+  }
+  t_scheduler->run_next_streak++;
+  dispatch_thread(t_block);
+}
+
+static int group_runnable(sched_group_t *group) {
+#ifdef MLFQ
+  return group->urgent_p_queue->head || group->high_p_queue->head ||
+         group->med_p_queue->head || group->low_p_queue->head;
+#else
+  return group->urgent_p_queue->head != NULL;
+#endif
+}
+
+/*
+ * Stride scheduling over the groups with ready threads. A group coming back
+ * from idle restarts at the current pass instead of its old, lower one.
+ */
+static sched_group_t *pick_group() {
+  sched_group_t *best = NULL;
+  unsigned long best_pass = 0;
+
+  for (sched_group_t *group = t_scheduler->groups; group;
+       group = group->next) {
+    if (!group_runnable(group)) {
+      continue;
+    }
+    unsigned long pass = group->pass < t_scheduler->group_pass
+                             ? t_scheduler->group_pass
+                             : group->pass;
+    if (best == NULL || pass < best_pass) {
+      best = group;
+      best_pass = pass;
+    }
+  }
+  return best;
 }
 
 // Preemptive RR scheduling algorithm
 static void sched_rr() {
   if (current_worker->status & (READY_T | RUNNING_T)) {
-    queue_t_enqueue(current_worker, urgent_p_queue);
+    queue_t_enqueue(current_worker, current_worker->group->urgent_p_queue);
+  }
+  swap_run_next();
+
+  sched_group_t *group = pick_group();
+  if (group) {
+    swap_threads(&group->urgent_p_queue);
   }
-  swap_threads(&urgent_p_queue);
 }
 
 #ifdef MLFQ
@@ -366,25 +1201,85 @@ void mlfq_schedule() {
    * 1. Among same priority threads, perform RR between each other
    * 2. Executes a queue only if the previous higher queue is empty.
    */
-  if (urgent_p_queue->head) {
-    swap_threads(&urgent_p_queue);
-  } else if (high_p_queue->head) {
-    swap_threads(&high_p_queue);
-  } else if (med_p_queue->head) {
-    swap_threads(&med_p_queue);
-  } else if (low_p_queue->head) {
-    swap_threads(&low_p_queue);
+  swap_run_next();
+
+  sched_group_t *group = pick_group();
+  if (group == NULL) {
+    return;
+  }
+
+  if (group->urgent_p_queue->head) {
+    swap_threads(&group->urgent_p_queue);
+  } else if (group->high_p_queue->head) {
+    swap_threads(&group->high_p_queue);
+  } else if (group->med_p_queue->head) {
+    swap_threads(&group->med_p_queue);
+  } else if (group->low_p_queue->head) {
+    swap_threads(&group->low_p_queue);
   }
 }
 
+/*
+ * Priority inheritance: a waiter blocking on a mutex lifts the owner (and
+ * whoever that owner is blocked on in turn) to its own level, so a low
+ * priority holder is not starved by the urgent threads waiting on it. Only
+ * priority is lifted, base_priority keeps the owner's own level.
+ */
+void mlfq_inherit_priority(tcb *waiter) {
+  worker_mutex_t *mutex = waiter->blocked_on;
+  while (mutex && mutex->owner && mutex->owner->priority < waiter->priority) {
+    tcb *owner = mutex->owner;
+
+    if (owner->status & TERMINATING_T) {
+      return;
+    }
+    DEBUG_OUT_ARG("Lifting priority of mutex owner", owner->t_id);
+
+    if ((owner->status & (READY_T | RUNNING_T)) &&
+        queue_t_remove(owner, group_queue(owner->group, owner->priority))) {
+      owner->priority = waiter->priority;
+      queue_t_enqueue(owner, group_queue(owner->group, owner->priority));
+    } else {
+      owner->priority = waiter->priority;
+    }
+    mutex = (owner->status & WAITING_T) ? owner->blocked_on : NULL;
+  }
+}
+
+/*
+ * Called with preemption disabled once owner gave up a mutex: its priority
+ * is its own level, or the highest waiter on a mutex it still holds. The
+ * owner is running, it sits in no ready queue.
+ */
+void mlfq_restore_priority(tcb *owner) {
+  priority_t priority = owner->base_priority;
+  for (worker_mutex_t *mutex = owner->held; mutex; mutex = mutex->held_next) {
+    list_node_t *node = mutex->block_list->head;
+    for (int i = 0; i < mutex->block_list->length; i++, node = node->next) {
+      if (node->t_block->priority > priority) {
+        priority = node->t_block->priority;
+      }
+    }
+  }
+  owner->priority = priority;
+}
+
 // Preemptive MLFQ scheduling algorithm
 static void sched_mlfq() {
+  if (mlfq_boost_pending) {
+    mlfq_all_threads_urgent();
+  }
+
   if (current_worker->status & (WAITING_T | TERMINATING_T)) {
+    if (current_worker->status & WAITING_T) {
+      mlfq_inherit_priority(current_worker);
+    }
     mlfq_schedule();
     return;
   }
 
   priority_t priority = current_worker->priority;
+  sched_group_t *group = current_worker->group;
   int is_yield_thread = 0;
   if (current_worker->is_yield == 1) {
     is_yield_thread = 1;
@@ -395,30 +1290,27 @@ static void sched_mlfq() {
   }
   current_worker->is_yield = 0;
 
-  if (is_yield_thread) {
+  // a thread running on inherited priority keeps it until it unlocks, only
+  // its own level is demoted meanwhile
+  priority_t base = current_worker->base_priority;
+  int is_lent = priority > base;
 
-    // If the current thread yielded retain in the same priority queue
-    if (priority & HIGH_PRIORITY_T) {
-      queue_t_enqueue(current_worker, high_p_queue);
-    } else if (priority & MEDIUM_PRIORITY_T) {
-      queue_t_enqueue(current_worker, med_p_queue);
-    } else if (priority & LOW_PRIORITY_T) {
-      queue_t_enqueue(current_worker, low_p_queue);
+  // If the current thread yielded retain in the same priority queue
+  if (!is_yield_thread) {
+    if (base & HIGH_PRIORITY_T) {
+      base = MEDIUM_PRIORITY_T;
+    } else if (base & (MEDIUM_PRIORITY_T | LOW_PRIORITY_T)) {
+      base = LOW_PRIORITY_T;
     } else {
-      queue_t_enqueue(current_worker, urgent_p_queue);
-    }
-  } else {
-    if (priority & HIGH_PRIORITY_T) {
-      current_worker->priority = MEDIUM_PRIORITY_T;
-      queue_t_enqueue(current_worker, med_p_queue);
-    } else if (priority & (MEDIUM_PRIORITY_T | LOW_PRIORITY_T)) {
-      current_worker->priority = LOW_PRIORITY_T;
-      queue_t_enqueue(current_worker, low_p_queue);
-    } else {
-      current_worker->priority = HIGH_PRIORITY_T;
-      queue_t_enqueue(current_worker, high_p_queue);
+      base = HIGH_PRIORITY_T;
     }
+    current_worker->base_priority = base;
+  }
+
+  if (!is_lent) {
+    current_worker->priority = base;
   }
+  queue_t_enqueue(current_worker, group_queue(group, current_worker->priority));
   mlfq_schedule();
 }
 #endif
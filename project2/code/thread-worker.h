@@ -23,13 +23,35 @@ typedef enum worker_ret_status {
   FAILED_WCS = 0,
   LIMIT_REACHED_WCS = 1,
   MALLOC_FAILURE_WCS = 2,
-  NO_THREADS_CREATED_WCS = 3
+  NO_THREADS_CREATED_WCS = 3,
+  INVALID_THREAD_WCS = 4
 } worker_status;
 
 /* create a new thread */
 int worker_create(worker_t *thread, pthread_attr_t *attr,
                   void *(*function)(void *), void *arg);
 
+/*
+ * fair-share groups: groups get CPU in proportion to their weight
+ * (1..GROUP_WEIGHT_MAX, the default group has GROUP_WEIGHT_DEFAULT) however
+ * many threads each one runs; threads inherit their creator's group
+ */
+int worker_group_create(worker_group_t *group, int weight);
+int worker_group_destroy(worker_group_t group);
+int worker_create_grouped(worker_t *thread, worker_group_t group,
+                          pthread_attr_t *attr, void *(*function)(void *),
+                          void *arg);
+
+/* create n threads running function(args[i]) from a single allocation */
+int worker_create_n(worker_t *threads, int n, pthread_attr_t *attr,
+                    void *(*function)(void *), void **args);
+
+/* wait for all threads of a worker_create_n batch with a single wakeup */
+int worker_join_all(worker_t *threads, int n, void **value_ptrs);
+
+/* id of the calling thread, 0 before the scheduler has started */
+worker_t worker_self();
+
 /* give CPU pocession to other user level worker threads voluntarily */
 int worker_yield();
 
@@ -39,6 +61,16 @@ void worker_exit(void *value_ptr);
 /* wait for thread termination */
 int worker_join(worker_t thread, void **value_ptr);
 
+/* let the scheduler reclaim the thread on exit, it can no longer be joined */
+int worker_detach(worker_t thread);
+
+/*
+ * sleep till worker_unpark, which other pthreads and signal handlers may
+ * call as well; an unpark before the park is not lost
+ */
+void worker_park();
+int worker_unpark(worker_t thread);
+
 /* initial the mutex lock */
 int worker_mutex_init(worker_mutex_t *mutex,
                       const pthread_mutexattr_t *mutexattr);
@@ -46,10 +78,48 @@ int worker_mutex_init(worker_mutex_t *mutex,
 /* aquire the mutex lock */
 int worker_mutex_lock(worker_mutex_t *mutex);
 
+/* aquire the mutex lock only if it is free, non zero when it is held */
+int worker_mutex_trylock(worker_mutex_t *mutex);
+
 /* release the mutex lock */
 int worker_mutex_unlock(worker_mutex_t *mutex);
 
 /* destroy the mutex */
 int worker_mutex_destroy(worker_mutex_t *mutex);
 
+/* deepest stack use of a live thread so far, needs STACK_PROF=1 */
+size_t worker_stack_usage(worker_t thread);
+
+/* stack high-water marks per start routine and as a histogram */
+void worker_stack_report(FILE *out);
+
+/*
+ * thread specific data, up to WORKER_KEYS_MAX keys per process. create,
+ * delete and setspecific return SUCCESS_WCS; create returns LIMIT_REACHED_WCS
+ * once every key is taken, delete and setspecific FAILED_WCS for a key that
+ * was never created or is deleted
+ */
+int worker_key_create(worker_key_t *key, void (*destructor)(void *));
+int worker_key_delete(worker_key_t key);
+int worker_setspecific(worker_key_t key, const void *value);
+void *worker_getspecific(worker_key_t key);
+
+/* rcu read side, free of atomics; a preempted reader delays grace periods */
+void worker_rcu_read_lock();
+void worker_rcu_read_unlock();
+
+/* wait till every read section open at the time of the call has closed */
+void worker_synchronize_rcu();
+
+/* run func(head) once a grace period has passed, from the scheduler */
+void worker_call_rcu(worker_rcu_head *head, void (*func)(worker_rcu_head *));
+
+/* publish and read rcu protected pointers */
+#define worker_rcu_assign_pointer(p, v)                                        \
+  __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#define worker_rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_CONSUME)
+
+/* write the recorded scheduling events as Chrome trace JSON (TRACE=1) */
+int worker_trace_dump(const char *path);
+
 #endif
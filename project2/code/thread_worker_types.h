@@ -16,6 +16,13 @@ typedef unsigned int worker_t;
 
 #define MAX_THREAD_COUNT 200
 #define YIELD_LIMIT 100
+#define WORKER_KEYS_MAX 8
+#define WORKER_KEY_DESTRUCTOR_ROUNDS 4
+#define GROUP_WEIGHT_DEFAULT 100
+#define GROUP_WEIGHT_MAX 10000
+
+typedef unsigned int worker_key_t;
+typedef struct sched_group_t *worker_group_t;
 
 // for now lets treat there are only two status? waiting being nothing is there
 // types?
@@ -33,10 +40,32 @@ typedef enum priority_t {
   URGENT_PRIORITY_T = 8
 } priority_t;
 
+typedef struct worker_rcu_head {
+  struct worker_rcu_head *next;
+  void (*func)(struct worker_rcu_head *);
+  unsigned long gp_seq;
+} worker_rcu_head;
+
 typedef struct tcb {
   worker_t t_id; // node pointer
   status_t status;
-  priority_t priority;
+  priority_t priority;      // base_priority, or higher while waiters lend theirs
+  priority_t base_priority; // own MLFQ level, demoted and boosted by the timer
+  struct worker_mutex_t *held; // owned mutexes, newest first
+  struct worker_mutex_t *blocked_on;
+  struct tcb *joiner; // woken by the scheduler once this thread terminates
+  int is_detached;    // reclaimed by the scheduler instead of worker_join
+  struct tcb *next_cached;
+  struct sched_group_t *group; // fair-share group whose queues it runs from
+  struct worker_batch_t *batch; // set when made by worker_create_n
+  struct tcb *wake_next;        // link in the scheduler's wakeup inbox
+  int wake_affine;              // claims the "run next" slot when drained
+  int parked;                   // sleeping in worker_park
+  int permit;                   // left by worker_unpark
+  int rcu_nesting;          // open rcu read sections
+  unsigned long rcu_qs_seq; // switch count at the last quiescent state
+  void *specific[WORKER_KEYS_MAX]; // values of the thread specific keys
+  void *start_routine;             // groups the stack profile per routine
   ucontext_t context;
   int is_yield;
   int yield_cnt;
@@ -0,0 +1,135 @@
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static const char *trace_names[] = {"dispatch", "preempt", "yield",
+                                    "block",    "wake",    "exit"};
+
+static trace_ring *trace_rings = NULL;
+#ifdef SCHED_TRACE
+static __thread trace_ring *local_ring = NULL;
+#endif
+
+// reference points to convert TSC ticks to microseconds at dump time
+static uint64_t base_tsc = 0;
+static uint64_t base_ns = 0;
+
+static uint64_t read_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t read_tsc() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return read_ns();
+#endif
+}
+
+#ifdef SCHED_TRACE
+static trace_ring *trace_ring_create() {
+  trace_ring *ring;
+
+  if ((ring = calloc(1, sizeof(trace_ring))) == NULL) {
+    DEBUG_OUT("Memory allocation for trace ring failed");
+    return NULL;
+  }
+  ring->k_tid = syscall(SYS_gettid);
+
+  uint64_t expected = 0;
+  uint64_t now_ns = read_ns();
+  if (__atomic_compare_exchange_n(&base_ns, &expected, now_ns, 0,
+                                  __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+    __atomic_store_n(&base_tsc, read_tsc(), __ATOMIC_RELEASE);
+  }
+
+  // lock-free push onto the registry
+  ring->next = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE);
+  while (!__atomic_compare_exchange_n(&trace_rings, &ring->next, ring, 1,
+                                      __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+    ;
+  return ring;
+}
+
+// from thread context before the timer is armed, calloc is not safe from
+// the SIGPROF handler that may record the first event
+void trace_thread_init() {
+  if (local_ring == NULL) {
+    local_ring = trace_ring_create();
+  }
+}
+
+// events on a kernel thread that never called trace_thread_init are dropped
+void trace_event(trace_event_t event, worker_t t_id) {
+  trace_ring *ring = local_ring;
+
+  if (ring == NULL) {
+    return;
+  }
+  uint64_t slot = __atomic_fetch_add(&ring->head, 1, __ATOMIC_ACQ_REL);
+  trace_record *record = &ring->records[slot & (TRACE_RING_SIZE - 1)];
+  record->tsc = read_tsc();
+  record->t_id = t_id;
+  record->event = event;
+}
+#endif
+
+int trace_dump(const char *path) {
+  FILE *out;
+
+  if ((out = fopen(path, "w")) == NULL) {
+    DEBUG_OUT("Unable to open trace file");
+    return -1;
+  }
+  double ticks_per_us = 1.0;
+  uint64_t start_tsc = __atomic_load_n(&base_tsc, __ATOMIC_ACQUIRE);
+  uint64_t elapsed_ns = read_ns() - base_ns;
+
+  if (start_tsc && elapsed_ns) {
+    ticks_per_us = (double)(read_tsc() - start_tsc) * 1000.0 / elapsed_ns;
+  }
+
+  fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  int is_first = 1;
+  for (trace_ring *ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE);
+       ring; ring = ring->next) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t slot = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+    fprintf(out,
+            "%s\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"args\":{\"name\":\"kernel thread %d\"}}",
+            is_first ? "" : ",", ring->k_tid, ring->k_tid);
+    is_first = 0;
+    for (; slot < head; slot++) {
+      trace_record *record = &ring->records[slot & (TRACE_RING_SIZE - 1)];
+      double ts = (double)(record->tsc - start_tsc) / ticks_per_us;
+
+      // a worker's slice runs from its dispatch to whatever switched it out
+      const char *phase = "E";
+      if (record->event == DISPATCH_EV) {
+        phase = "B";
+      } else if (record->event == WAKE_EV) {
+        phase = "i";
+      }
+      int is_instant = phase[0] == 'i';
+      fprintf(out,
+              ",\n{\"name\":\"%s\",\"cat\":\"sched\",\"ph\":\"%s\",%s"
+              "\"pid\":%d,\"tid\":%lu,\"ts\":%.3f,"
+              "\"args\":{\"event\":\"%s\"}}",
+              is_instant ? trace_names[record->event] : "running", phase,
+              is_instant ? "\"s\":\"t\"," : "", ring->k_tid,
+              (unsigned long)record->t_id, ts, trace_names[record->event]);
+    }
+  }
+  fprintf(out, "\n]}\n");
+  fclose(out);
+  return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef SCHED_TRACE_H
+#define SCHED_TRACE_H
+
+#include "thread_worker_types.h"
+#include <stdint.h>
+#include <sys/types.h>
+
+// records kept per kernel thread, oldest are overwritten (power of 2)
+#define TRACE_RING_SIZE (1 << 16)
+
+typedef enum trace_event_t {
+  DISPATCH_EV = 0,
+  PREEMPT_EV = 1,
+  YIELD_EV = 2,
+  BLOCK_EV = 3,
+  WAKE_EV = 4,
+  EXIT_EV = 5
+} trace_event_t;
+
+typedef struct trace_record {
+  uint64_t tsc;
+  worker_t t_id;
+  trace_event_t event;
+} trace_record;
+
+/*
+ * Single writer ring, only the kernel thread owning it appends. The head is
+ * bumped with one atomic add so a record taken from a signal handler on the
+ * same kernel thread never tears a record being written underneath it.
+ */
+typedef struct trace_ring {
+  trace_record records[TRACE_RING_SIZE];
+  uint64_t head;
+  pid_t k_tid;
+  struct trace_ring *next; // registry of all the rings, for the dump
+} trace_ring;
+
+#ifdef SCHED_TRACE
+void trace_thread_init();
+void trace_event(trace_event_t event, worker_t t_id);
+#define TRACE_THREAD_INIT() trace_thread_init()
+#define TRACE_EVENT(event, t_id) trace_event(event, t_id)
+#else
+#define TRACE_THREAD_INIT()
+#define TRACE_EVENT(event, t_id)
+#endif
+
+/* writes every ring as Chrome trace-event JSON (chrome://tracing, Perfetto) */
+int trace_dump(const char *path);
+
+#endif
@@ -11,6 +11,29 @@ ${COMPILE} -o mem_handle.out benchmark/test_code.c my_vm.a
 readelf -h my_vm.a | grep Class
 readelf -h mem_handle.out | grep Class
 ${RUN_CODE}
+echo Direct mapped TLB for comparison
+${RUN_CODE} 512 1
+echo Concurrent allocation and access
+${COMPILE} -o threads_handle.out benchmark/test_threads.c my_vm.a -lpthread
+./threads_handle.out 8
+echo put_value/get_value bandwidth
+${COMPILE} -o bandwidth_handle.out benchmark/test_bandwidth.c my_vm.a
+./bandwidth_handle.out
+echo Tiled matrix multiplication
+${COMPILE} -o mat_mult_handle.out benchmark/test_mat_mult.c my_vm.a -lpthread
+./mat_mult_handle.out
+echo Scattered small values, one call each and batched
+${COMPILE} -o scatter_handle.out benchmark/test_scatter.c my_vm.a -lpthread
+./scatter_handle.out
+echo Small allocations
+${COMPILE} -o small_alloc_handle.out benchmark/test_small_alloc.c my_vm.a -lpthread
+./small_alloc_handle.out
+echo Working set over the physical pool, with swap
+${COMPILE} -o swap_handle.out benchmark/test_swap.c my_vm.a -lpthread
+./swap_handle.out 4
+echo Address spaces sharing virtual addresses
+${COMPILE} -o spaces_handle.out benchmark/test_spaces.c my_vm.a -lpthread
+./spaces_handle.out 8
 
 echo Testing 32 bit
 rm -rf *.o *.a *.out
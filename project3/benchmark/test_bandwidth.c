@@ -0,0 +1,57 @@
+// put_value/get_value throughput for transfers from 4 KiB to 64 MiB
+// gcc -g -w -o test_bandwidth.out test_bandwidth.c ../my_vm.a
+
+#include "../my_vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MIN_TRANSFER (4UL*1024)
+#define MAX_TRANSFER (64UL*1024*1024)
+#define BYTES_PER_SIZE (256UL*1024*1024) // moved per size and direction
+
+double now_sec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+int main() {
+  unsigned char *src = malloc(MAX_TRANSFER);
+  unsigned char *dst = malloc(MAX_TRANSFER);
+  for (size_t i = 0; i < MAX_TRANSFER; i++) {
+    src[i] = rand();
+  }
+  printf("bytes,put MB/s,get MB/s\n");
+  for (size_t size = MIN_TRANSFER; size <= MAX_TRANSFER; size *= 4) {
+    void *test = t_malloc(size);
+
+    if (test == NULL) {
+      printf("Exceeded track limits %ld\n", size);
+      return -1;
+    }
+    size_t rounds = BYTES_PER_SIZE/size;
+    double start = now_sec();
+    for (size_t i = 0; i < rounds; i++) {
+      put_value((page_t)test, src, size);
+    }
+    double put_secs = now_sec() - start;
+    start = now_sec();
+    for (size_t i = 0; i < rounds; i++) {
+      get_value((page_t)test, dst, size);
+    }
+    double get_secs = now_sec() - start;
+
+    if (memcmp(src, dst, size) != 0) {
+      printf("Read back of %ld bytes does not match\n", size);
+      return -1;
+    }
+    double mbytes = (double)rounds*size/(1024*1024);
+    printf("%ld,%.1f,%.1f\n", size, mbytes/put_secs, mbytes/get_secs);
+    t_free((page_t)test, size);
+  }
+  free(src);
+  free(dst);
+  return 0;
+}
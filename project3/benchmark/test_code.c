@@ -40,15 +40,22 @@ int check_rw_opr() {
   int level = (rand() % MAX_RW_VALUE) + 1;
   void *test = t_malloc(VAL_SIZE*level);
   data_var *val_array = (data_var*)malloc(VAL_SIZE*level);
+  data_var *read_array = (data_var*)malloc(VAL_SIZE*level);
+  vm_access *accesses = (vm_access*)malloc(sizeof(vm_access)*level);
   for (int i = 0; i < level; i++) {
-    data_var data = rand();
-    put_value((page_t)(test+(i*VAL_SIZE)), &data, VAL_SIZE);
-    val_array[i] = data;
+    val_array[i] = rand();
+    accesses[i].addr = (page_t)(test+(i*VAL_SIZE));
+    accesses[i].val = &val_array[i];
+    accesses[i].len = VAL_SIZE;
   }
-  void *start = test;
-  for (int i = 0; i < level; i++, start+=VAL_SIZE) {
-    data_var val = 0;
-    get_value((page_t)start, &val, VAL_SIZE);
+  put_values(accesses, level);
+  for (int i = 0; i < level; i++) {
+    read_array[i] = 0;
+    accesses[i].val = &read_array[i];
+  }
+  get_values(accesses, level);
+  for (int i = 0; i < level; i++) {
+    data_var val = read_array[i];
 
     if (val != val_array[i]) {
       printf("\nValue at pos %d::%lld, is not matching with value obtained %lld\n", i, val_array[i], val);
@@ -64,6 +71,8 @@ int check_rw_opr() {
 #endif
   t_free((page_t)test, VAL_SIZE*level);
   free(val_array);
+  free(read_array);
+  free(accesses);
   return 0;
 }
 
@@ -80,20 +89,30 @@ void test_rw_opr() {
 }
 
 int verify_mat_values(page_t mat_c, data_var *mat_z, int col, int row, const char *opr, int count) {
-  page_t address_c;
   data_var value_c, value_z;
-  for (size_t i = 0; i < col; i++) {
+  data_var *values = (data_var*)malloc(VAL_SIZE*col*row);
+  vm_access *accesses = (vm_access*)malloc(sizeof(vm_access)*col*row);
+  for (size_t i = 0; i < col*row; i++) {
+    accesses[i].addr = mat_c + (i*VAL_SIZE);
+    accesses[i].val = &values[i];
+    accesses[i].len = VAL_SIZE;
+  }
+  get_values(accesses, col*row);
+  int ret = 0;
+  for (size_t i = 0; i < col && ret == 0; i++) {
     for (size_t j = 0; j < row; j++) {
-      address_c = mat_c + (i*row*VAL_SIZE) + (j*VAL_SIZE);
       value_z = *(mat_z + (i*row) + j);
-      get_value(address_c, &value_c, VAL_SIZE);
+      value_c = values[(i*row) + j];
       if (value_c != value_z) {
         printf("%s operation failed during iteration %d, value at matrix[%ld][%ld]=%lld does not match with value obtained %lld\n", opr, count, i, j, value_z, value_c);
-        return 1;
+        ret = 1;
+        break;
       }
     }
   }
-  return 0;
+  free(values);
+  free(accesses);
+  return ret;
 }
 
 int check_and_fill_mat(page_t mat_m, data_var *mat_n, int col, int row, int count) {
@@ -212,7 +231,12 @@ void test_mat_mult() {
   print_TLB_missrate();
 }
 
-int main() {
+// ./test.out [sets ways] runs with the given TLB geometry, 512 1 is direct mapped
+int main(int argc, char **argv) {
+  if (argc == 3 && set_TLB_geometry(atoi(argv[1]), atoi(argv[2])) == -1) {
+    printf("TLB sets has to be a power of two\n");
+    return -1;
+  }
   srand(time(NULL));
   test_malloc();
   test_rw_opr();
@@ -0,0 +1,81 @@
+// mat_mult time on square matrices, checked against a plain multiply
+// gcc -g -w -o test_mat_mult.out test_mat_mult.c ../my_vm.a
+
+#include "../my_vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MIN_DIM 64
+#define MAX_DIM 512
+
+double now_sec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+// same as mat_mult_page in test_code.c, values of val_size bytes
+page_t get_val(const unsigned char *mat, size_t pos, size_t val_size) {
+  page_t value = 0;
+  memcpy(&value, mat + pos*val_size, val_size);
+  return value;
+}
+
+void mat_mult_page(const unsigned char *l, const unsigned char *r, unsigned char *o, size_t dim, size_t val_size) {
+  for (size_t i = 0; i < dim; i++) {
+    for (size_t j = 0; j < dim; j++) {
+      page_t value_o = 0;
+      for (size_t k = 0; k < dim; k++) {
+        value_o += get_val(l, i*dim + k, val_size)*get_val(r, k*dim + j, val_size);
+      }
+      memcpy(o + (i*dim + j)*val_size, &value_o, val_size);
+    }
+  }
+}
+
+int check_dim(size_t dim, size_t val_size) {
+  size_t bytes = dim*dim*val_size;
+  unsigned char *mat_x = malloc(bytes), *mat_y = malloc(bytes);
+  unsigned char *mat_z = malloc(bytes), *mat_c = malloc(bytes);
+  for (size_t i = 0; i < bytes; i++) {
+    mat_x[i] = rand();
+    mat_y[i] = rand();
+  }
+  void *mat_a = t_malloc(bytes), *mat_b = t_malloc(bytes), *mat_o = t_malloc(bytes);
+
+  if (mat_a == NULL || mat_b == NULL || mat_o == NULL) {
+    printf("Exceeded track limits %ld\n", bytes);
+    return -1;
+  }
+  put_value((page_t)mat_a, mat_x, bytes);
+  put_value((page_t)mat_b, mat_y, bytes);
+  double start = now_sec();
+  mat_mult((page_t)mat_a, (page_t)mat_b, (page_t)mat_o, dim, dim, dim, val_size);
+  double secs = now_sec() - start;
+  mat_mult_page(mat_x, mat_y, mat_z, dim, val_size);
+  get_value((page_t)mat_o, mat_c, bytes);
+  int ret = memcmp(mat_c, mat_z, bytes) ? -1 : 0;
+  printf("%ld,%ld,%.4f,%.1f,%s\n", dim, val_size, secs, 2.0*dim*dim*dim/secs/1e6,
+         ret ? "mismatch" : "ok");
+  t_free((page_t)mat_a, bytes);
+  t_free((page_t)mat_b, bytes);
+  t_free((page_t)mat_o, bytes);
+  free(mat_x);
+  free(mat_y);
+  free(mat_z);
+  free(mat_c);
+  return ret;
+}
+
+int main() {
+  int ret = 0;
+  printf("dim,value bytes,seconds,MFLOP/s,result\n");
+  for (size_t dim = MIN_DIM; dim <= MAX_DIM; dim *= 2) {
+    ret |= check_dim(dim, sizeof(page_t));
+  }
+  ret |= check_dim(MIN_DIM + 3, sizeof(int)); // partial tiles, narrow values
+  print_TLB_missrate();
+  return ret;
+}
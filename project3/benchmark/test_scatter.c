@@ -0,0 +1,82 @@
+// Random small values: get_value/put_value per value against one batch
+// gcc -g -w -o test_scatter.out test_scatter.c ../my_vm.a
+// ./test_scatter.out [values], the copies alone are the baseline
+
+#include "../my_vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BUFFER_SIZE (16UL*1024*1024)
+#define VAL_SIZE sizeof(page_t)
+
+double now_sec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+int main(int argc, char **argv) {
+  size_t cnt = argc > 1 ? atol(argv[1]) : 1000000;
+  unsigned char *plain = malloc(BUFFER_SIZE);
+  page_t *src = malloc(cnt*VAL_SIZE), *dst = malloc(cnt*VAL_SIZE);
+  page_t *offsets = malloc(cnt*sizeof(page_t));
+  vm_access *accesses = malloc(cnt*sizeof(vm_access));
+  void *test = t_malloc(BUFFER_SIZE);
+
+  if (test == NULL) {
+    printf("Exceeded track limits %ld\n", BUFFER_SIZE);
+    return -1;
+  }
+  for (size_t i = 0; i < cnt; i++) {
+    offsets[i] = (rand() % (BUFFER_SIZE/VAL_SIZE))*VAL_SIZE;
+    src[i] = rand();
+  }
+  printf("method,values,ns/value\n");
+
+  double start = now_sec();
+  for (size_t i = 0; i < cnt; i++) {
+    memcpy(plain + offsets[i], &src[i], VAL_SIZE);
+  }
+  for (size_t i = 0; i < cnt; i++) {
+    memcpy(&dst[i], plain + offsets[i], VAL_SIZE);
+  }
+  printf("memcpy,%ld,%.1f\n", cnt, (now_sec() - start)*1e9/(2*cnt));
+
+  start = now_sec();
+  for (size_t i = 0; i < cnt; i++) {
+    put_value((page_t)test + offsets[i], &src[i], VAL_SIZE);
+  }
+  for (size_t i = 0; i < cnt; i++) {
+    get_value((page_t)test + offsets[i], &dst[i], VAL_SIZE);
+  }
+  printf("put_value/get_value,%ld,%.1f\n", cnt, (now_sec() - start)*1e9/(2*cnt));
+
+  start = now_sec();
+  for (size_t i = 0; i < cnt; i++) {
+    accesses[i].addr = (page_t)test + offsets[i];
+    accesses[i].val = &src[i];
+    accesses[i].len = VAL_SIZE;
+  }
+  put_values(accesses, cnt);
+  for (size_t i = 0; i < cnt; i++) {
+    accesses[i].val = &dst[i];
+  }
+  get_values(accesses, cnt);
+  printf("put_values/get_values,%ld,%.1f\n", cnt, (now_sec() - start)*1e9/(2*cnt));
+
+  // a value written twice keeps the later one, compare against the plain buffer
+  for (size_t i = 0; i < cnt; i++) {
+    page_t val = 0;
+    memcpy(&val, plain + offsets[i], VAL_SIZE);
+
+    if (dst[i] != val) {
+      printf("Value %ld does not match\n", i);
+      return -1;
+    }
+  }
+  print_TLB_missrate();
+  t_free((page_t)test, BUFFER_SIZE);
+  return 0;
+}
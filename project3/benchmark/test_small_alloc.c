@@ -0,0 +1,51 @@
+// Frames used by many small allocations, freed without passing the size
+// gcc -g -w -o test_small_alloc.out test_small_alloc.c ../my_vm.a -lpthread
+
+#include "../my_vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ALLOC_COUNT 20000
+#define MAX_OBJ_SIZE 256
+
+extern vm_manager mem_manager;
+
+int main() {
+  void **objs = malloc(sizeof(void *)*ALLOC_COUNT);
+  size_t *sizes = malloc(sizeof(size_t)*ALLOC_COUNT);
+  size_t requested = 0;
+  initialize_vm();
+  page_t frames_start = mem_manager.frames_free;
+  for (int i = 0; i < ALLOC_COUNT; i++) {
+    sizes[i] = (rand() % MAX_OBJ_SIZE) + 1;
+    requested += sizes[i];
+
+    if ((objs[i] = t_malloc(sizes[i])) == NULL) {
+      printf("Allocation %d of %ld bytes failed\n", i, sizes[i]);
+      return -1;
+    }
+    put_value((page_t)objs[i], &i, sizes[i] < sizeof(i) ? sizes[i] : sizeof(i));
+  }
+  page_t frames_used = frames_start - mem_manager.frames_free;
+  printf("%d allocations, %ld bytes requested, %lld frames used (%lld bytes)\n",
+         ALLOC_COUNT, requested, (long long)frames_used, (long long)(frames_used*PAGE_SIZE));
+
+  for (int i = 0; i < ALLOC_COUNT; i++) {
+    int val = 0;
+    get_value((page_t)objs[i], &val, sizes[i] < sizeof(val) ? sizes[i] : sizeof(val));
+
+    if (sizes[i] >= sizeof(val) && val != i) {
+      printf("Value at allocation %d::%d, is not matching with value obtained %d\n", i, i, val);
+      return -1;
+    }
+
+    if (t_free((page_t)objs[i], 0) != 0) {
+      printf("Free of allocation %d failed\n", i);
+      return -1;
+    }
+  }
+  printf("Frames in use after freeing all: %lld\n", (long long)(frames_start - mem_manager.frames_free));
+  free(objs);
+  free(sizes);
+  return 0;
+}
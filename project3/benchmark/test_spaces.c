@@ -0,0 +1,92 @@
+// Address spaces that map the same virtual addresses to their own frames
+// gcc -g -w -o test_spaces.out test_spaces.c ../my_vm.a -lpthread
+// ./test_spaces.out [spaces], switching does not flush the TLB
+
+#include "../my_vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MAX_SPACES 64
+#define BUFFER_SIZE (128*1024)
+#define ROUNDS 200
+
+extern vm_manager mem_manager;
+
+// the value stored at word i of a space's buffer
+page_t pattern(int id, page_t i) {
+  return (i*2654435761UL) ^ id;
+}
+
+int main(int argc, char **argv) {
+  int space_cnt = argc > 1 ? atoi(argv[1]) : 8;
+
+  if (space_cnt < 1 || space_cnt > MAX_SPACES) {
+    printf("Space count has to be within 1..%d\n", MAX_SPACES);
+    return -1;
+  }
+  initialize_vm();
+  page_t frames_start = mem_manager.frames_free;
+  address_space *spaces[MAX_SPACES];
+  page_t buffers[MAX_SPACES];
+  page_t words = BUFFER_SIZE/sizeof(page_t);
+  page_t *chunk = malloc(BUFFER_SIZE);
+  int ret = 0;
+  for (int s = 0; s < space_cnt; s++) {
+    if ((spaces[s] = create_address_space()) == NULL) {
+      printf("Address space %d could not be created\n", s);
+      return -1;
+    }
+    switch_address_space(spaces[s]);
+
+    if ((buffers[s] = (page_t)t_malloc(BUFFER_SIZE)) == 0) {
+      printf("Allocation in space %d failed\n", s);
+      return -1;
+    }
+    for (page_t i = 0; i < words; i++) {
+      chunk[i] = pattern(s, i);
+    }
+    put_value(buffers[s], chunk, BUFFER_SIZE);
+  }
+  for (int s = 1; s < space_cnt; s++) {
+    if (buffers[s] != buffers[0]) {
+      printf("Space %d got a different first address\n", s);
+      ret = -1;
+    }
+  }
+
+  // round robin over the spaces, a word per page of each buffer
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int round = 0; round < ROUNDS; round++) {
+    for (int s = 0; s < space_cnt; s++) {
+      switch_address_space(spaces[s]);
+      for (page_t i = round % (PAGE_SIZE/sizeof(page_t)); i < words; i += PAGE_SIZE/sizeof(page_t)) {
+        page_t val = 0;
+        get_value(buffers[s] + i*sizeof(page_t), &val, sizeof(page_t));
+
+        if (val != pattern(s, i)) {
+          printf("Space %d, word %lu does not match\n", s, i);
+          return -1;
+        }
+      }
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  printf("%d spaces x %d rounds, %.3f seconds\n", space_cnt, ROUNDS,
+         (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9);
+  print_TLB_missrate();
+
+  switch_address_space(NULL);
+  for (int s = 0; s < space_cnt; s++) {
+    destroy_address_space(spaces[s]);
+  }
+  long long frames_used = frames_start - mem_manager.frames_free;
+  printf("Frames in use after destroying all: %lld\n", frames_used);
+
+  if (frames_used != 0) {
+    ret = -1;
+  }
+  free(chunk);
+  return ret;
+}
@@ -0,0 +1,111 @@
+// A working set bigger than the physical pool, kept alive by the swap file
+// gcc -g -w -o test_swap.out test_swap.c ../my_vm.a -lpthread
+// ./test_swap.out [threads], each thread owns BUFFER_SIZE of the working set
+
+#include "../my_vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define PHYS_SIZE (8UL*1024*1024)
+#define SWAP_SIZE (64UL*1024*1024)
+#define BUFFER_SIZE (8UL*1024*1024)
+#define CHUNK_SIZE (64*1024)
+#define MAX_THREADS 4
+#define PASSES 3
+
+typedef struct {
+  page_t buffer;
+  unsigned int seed;
+  int failed;
+} thread_arg;
+
+// the value stored at word i of a thread's buffer
+page_t pattern(int id, page_t i) {
+  return (i*2654435761UL) ^ id;
+}
+
+void *worker(void *arg) {
+  thread_arg *t_arg = arg;
+  int id = t_arg->seed;
+  page_t words = CHUNK_SIZE/sizeof(page_t);
+  page_t *chunk = malloc(CHUNK_SIZE);
+  for (page_t off = 0; off < BUFFER_SIZE; off += CHUNK_SIZE) {
+    for (page_t i = 0; i < words; i++) {
+      chunk[i] = pattern(id, off/sizeof(page_t) + i);
+    }
+    put_value(t_arg->buffer + off, chunk, CHUNK_SIZE);
+  }
+
+  // sequential passes, then random words all over the buffer
+  for (int pass = 0; pass < PASSES && !t_arg->failed; pass++) {
+    for (page_t off = 0; off < BUFFER_SIZE; off += CHUNK_SIZE) {
+      get_value(t_arg->buffer + off, chunk, CHUNK_SIZE);
+      for (page_t i = 0; i < words; i++) {
+        if (chunk[i] != pattern(id, off/sizeof(page_t) + i)) {
+          printf("Thread %d, word %lu does not match\n", id, off/sizeof(page_t) + i);
+          t_arg->failed = 1;
+          break;
+        }
+      }
+    }
+  }
+  for (int i = 0; i < 10000 && !t_arg->failed; i++) {
+    page_t word = rand_r(&t_arg->seed) % (BUFFER_SIZE/sizeof(page_t)), val = 0;
+    get_value(t_arg->buffer + word*sizeof(page_t), &val, sizeof(page_t));
+
+    if (val != pattern(id, word)) {
+      printf("Thread %d, random word %lu does not match\n", id, word);
+      t_arg->failed = 1;
+    }
+  }
+  free(chunk);
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  int thread_cnt = argc > 1 ? atoi(argv[1]) : 4;
+
+  if (thread_cnt < 1 || thread_cnt > MAX_THREADS) {
+    printf("Thread count has to be within 1..%d\n", MAX_THREADS);
+    return -1;
+  }
+
+  if (set_physical_mem_size(PHYS_SIZE) || set_swap_file("test_swap.swp", SWAP_SIZE)) {
+    printf("Swap could not be configured\n");
+    return -1;
+  }
+  pthread_t threads[MAX_THREADS];
+  thread_arg args[MAX_THREADS];
+  for (int i = 0; i < thread_cnt; i++) {
+    args[i].seed = i + 1;
+    args[i].failed = 0;
+
+    if ((args[i].buffer = (page_t)t_malloc(BUFFER_SIZE)) == 0) {
+      printf("Allocation %d failed\n", i);
+      return -1;
+    }
+  }
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < thread_cnt; i++) {
+    pthread_create(&threads[i], NULL, worker, &args[i]);
+  }
+  for (int i = 0; i < thread_cnt; i++) {
+    pthread_join(threads[i], NULL);
+
+    if (args[i].failed) {
+      printf("Thread %d failed\n", i);
+      return -1;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  printf("%d x %lu MB on %lu MB of frames, %.3f seconds\n", thread_cnt,
+         BUFFER_SIZE >> 20, PHYS_SIZE >> 20,
+         (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9);
+  print_swap_stats();
+  for (int i = 0; i < thread_cnt; i++) {
+    t_free(args[i].buffer, 0);
+  }
+  return 0;
+}
@@ -0,0 +1,89 @@
+// Concurrent t_malloc/put_value/get_value/t_free from several threads
+// gcc -g -w -o test_threads.out test_threads.c ../my_vm.a -lpthread
+// ./test_threads.out [max threads], runs 1, 2, 4, ... up to max threads
+
+#include "../my_vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef page_t data_var;
+
+#define MAX_THREADS 64
+#define OPS_PER_THREAD 2000
+#define MAX_VALUES 1024 // values per allocation, up to two pages
+#define VAL_SIZE sizeof(data_var)
+
+typedef struct {
+  unsigned int seed;
+  int failed;
+} thread_arg;
+
+void *worker(void *arg) {
+  thread_arg *t_arg = arg;
+  data_var *values = malloc(VAL_SIZE*MAX_VALUES);
+  for (int op = 0; op < OPS_PER_THREAD && !t_arg->failed; op++) {
+    int count = (rand_r(&t_arg->seed) % MAX_VALUES) + 1;
+    void *test = t_malloc(VAL_SIZE*count);
+
+    if (test == NULL) {
+      t_arg->failed = 1;
+      break;
+    }
+    for (int i = 0; i < count; i++) {
+      values[i] = rand_r(&t_arg->seed);
+      put_value((page_t)(test + i*VAL_SIZE), &values[i], VAL_SIZE);
+    }
+    for (int i = 0; i < count; i++) {
+      data_var val = 0;
+      get_value((page_t)(test + i*VAL_SIZE), &val, VAL_SIZE);
+
+      if (val != values[i]) {
+        printf("Value at pos %d::%lld, is not matching with value obtained %lld\n", i, values[i], val);
+        t_arg->failed = 1;
+        break;
+      }
+    }
+    t_free((page_t)test, VAL_SIZE*count);
+  }
+  free(values);
+  return NULL;
+}
+
+double run_threads(int thread_cnt) {
+  pthread_t threads[MAX_THREADS];
+  thread_arg args[MAX_THREADS];
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < thread_cnt; i++) {
+    args[i].seed = i + 1;
+    args[i].failed = 0;
+    pthread_create(&threads[i], NULL, worker, &args[i]);
+  }
+  for (int i = 0; i < thread_cnt; i++) {
+    pthread_join(threads[i], NULL);
+
+    if (args[i].failed) {
+      printf("Thread %d failed\n", i);
+      exit(-1);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9;
+}
+
+int main(int argc, char **argv) {
+  int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+
+  if (max_threads < 1 || max_threads > MAX_THREADS) {
+    printf("Thread count has to be within 1..%d\n", MAX_THREADS);
+    return -1;
+  }
+  printf("threads,seconds,allocs/s\n");
+  for (int thread_cnt = 1; thread_cnt <= max_threads; thread_cnt *= 2) {
+    double secs = run_threads(thread_cnt);
+    printf("%d,%.3f,%.0f\n", thread_cnt, secs, thread_cnt*OPS_PER_THREAD/secs);
+  }
+  print_TLB_missrate();
+  return 0;
+}
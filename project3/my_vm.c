@@ -1,17 +1,61 @@
 #include "my_vm.h"
 #include <stddef.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
 
 bool init_vm = false;
-vm_manager mem_manager;
-tlb_lookup mem_lookup;
+vm_manager mem_manager = {
+    .pm_lock = PTHREAD_MUTEX_INITIALIZER,
+    .vm_lock = PTHREAD_MUTEX_INITIALIZER,
+    .pt_lock = PTHREAD_RWLOCK_INITIALIZER,
+    .swap_fd = -1,
+    .swap_lock = PTHREAD_RWLOCK_INITIALIZER,
+};
+__thread tlb_lookup mem_lookup;
+static address_space default_space = {.asid = 0};
+static __thread address_space *curr_space = NULL; // NULL is the default space
+
+static pthread_once_t vm_once = PTHREAD_ONCE_INIT;
+static pthread_once_t tlb_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tlb_key; // frees a thread's TLB table when it exits
+static page_t tlb_epoch = 0;
+static page_t pwc_epoch = 0; // bumped when an address space frees its tables
+static page_t tlb_exited_count = 0, tlb_exited_miss = 0; // of exited threads
+static page_t tlb_exited_walks = 0, tlb_exited_skipped = 0;
+
+// every live t_malloc by first vpn, and the slabs with free objects per
+// class, are kept per address space
+static pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+static int tlb_sets = TLB_ENTRIES/TLB_WAYS, tlb_ways = TLB_WAYS;
+static unsigned int vm_range_seed = 1; // treap priorities, under vm_lock
 
 page_t total_virtual_pages = MAX_MEMSIZE/PAGE_SIZE;
 page_t total_physical_pages = MEMSIZE/PAGE_SIZE;
-page_t next_page_ref = (MEMSIZE/PAGE_SIZE) - 1;
+
+// buddy allocator over the frames: free_links[frame] links a free block into
+// its order's list, free_order[frame] is the block's order + 1 when it heads one
+static page_t free_heads[PM_ORDERS];
+static frame_link *free_links;
+static unsigned char *free_order;
+static page_t frames_unused = 0; // frames on the free lists
+
+// overcommit: data frames know their vpn (+ 1, 0 for none) so the clock hand
+// can evict them; frame_ref is the second chance bit, set on every translation
+static const char *swap_path = NULL;
+static page_t swap_slots = 0, swap_cursor = 0, clock_hand = 0;
+static page_t *frame_owner;
+static unsigned short *frame_asid; // the address space of frame_owner
+static unsigned char *frame_ref;
+static page_t swap_outs = 0, swap_ins = 0; // under swap_lock, as are the times
+static double swap_out_secs = 0, swap_in_secs = 0;
 
 int *vpn_bits = 0;
 page_t *vpn_pages = 0;
+int huge_bits = 0; // a huge page is a whole last level table, 1 << huge_bits pages
+int prefix_shift[VPN_LEVELS]; // vpn >> prefix_shift[level] picks the table at level
 
 void init_vbits() {
   int full_vpn_len = VM_LEN - PG_LEN;
@@ -30,6 +74,11 @@ void init_vbits() {
     vpn_bits[i] = vpn_len;
     vpn_pages[i] = page_req;
   }
+  huge_bits = vpn_bits[VPN_LEVELS - 1];
+  prefix_shift[VPN_LEVELS - 1] = vpn_bits[VPN_LEVELS - 1];
+  for (int i = VPN_LEVELS - 2; i >= 0; i--) {
+    prefix_shift[i] = prefix_shift[i + 1] + vpn_bits[i];
+  }
   mem_manager.frames_free = total_physical_pages;
   mem_manager.page_frame_usage = 0;
 }
@@ -65,50 +114,380 @@ static void reset_bit_at_index(bitmap **bit_map, int bit_index) {
 }
 
 void set_hunk(page_t *hunk, page_t data) {
-  for (page_t i = 0; i < PAGE_MEM_SIZE; i+=PG_PTR_SIZE) {
+  for (page_t i = 0; i < PAGE_MEM_SIZE; i++) {
     *(hunk + i) = data;
   }
 }
 
+frame_link *get_frame_link(page_t frame) {
+  return free_links + frame;
+}
+
+// address space only, the host commits a page when it is first touched
+void *reserve_memory(size_t size) {
+  void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+  if (mem == MAP_FAILED) {
+    fprintf(stderr, "Memory reservation of %zu bytes failed\n", size);
+    exit(EXIT_FAILURE);
+  }
+  return mem;
+}
+
+// free frames always read as zero; whole host pages go back to the host
+void zero_frames(page_t frame, page_t frame_cnt) {
+  unsigned char *mem = mem_manager.pg_mem + frame*PAGE_SIZE;
+  size_t size = frame_cnt*PAGE_SIZE;
+
+  if (PAGE_SIZE % sysconf(_SC_PAGESIZE) || madvise(mem, size, MADV_DONTNEED)) {
+    memset(mem, 0, size);
+  }
+}
+
+void frame_list_add(int order, page_t frame) {
+  frame_link *link = get_frame_link(frame);
+  link->prev = NO_FRAME;
+  link->next = free_heads[order];
+
+  if (free_heads[order] != NO_FRAME) {
+    get_frame_link(free_heads[order])->prev = frame;
+  }
+  free_heads[order] = frame;
+  free_order[frame] = order + 1;
+}
+
+void frame_list_del(int order, page_t frame) {
+  frame_link *link = get_frame_link(frame);
+
+  if (link->prev != NO_FRAME) {
+    get_frame_link(link->prev)->next = link->next;
+  } else {
+    free_heads[order] = link->next;
+  }
+
+  if (link->next != NO_FRAME) {
+    get_frame_link(link->next)->prev = link->prev;
+  }
+  free_order[frame] = 0;
+}
+
+// the bitmap only cross-checks the buddy lists now, a mismatch is a bug
+void verify_frames(page_t frame, page_t frame_cnt, int is_used) {
+  for (page_t i = frame; i < frame + frame_cnt; i++) {
+    if (get_bit_at_index(mem_manager.pm_bitmap, i) == is_used) {
+      fprintf(stderr, "Frame %lu is already %s\n", (unsigned long)i, is_used ? "used" : "free");
+    }
+
+    if (is_used) {
+      set_bit_at_index(&mem_manager.pm_bitmap, i);
+    } else {
+      reset_bit_at_index(&mem_manager.pm_bitmap, i);
+    }
+  }
+}
+
+// 2^order contiguous frames, called with pm_lock held; 0 when none are left
+int frame_alloc(int order, page_t *frame) {
+  int curr_order = order;
+  while (curr_order < PM_ORDERS && free_heads[curr_order] == NO_FRAME) {
+    curr_order++;
+  }
+
+  if (curr_order >= PM_ORDERS) {
+    return 0;
+  }
+  page_t block = free_heads[curr_order];
+  frame_list_del(curr_order, block);
+  while (curr_order > order) {
+    curr_order--; // the lower half is split further, the upper half is free
+    frame_list_add(curr_order, block + ((page_t)1 << curr_order));
+  }
+  verify_frames(block, (page_t)1 << order, 1);
+  frames_unused -= (page_t)1 << order;
+  *frame = block;
+  return 1;
+}
+
+// called with pm_lock held, merges with the buddy as long as it is free
+void frame_free(page_t frame, int order) {
+  verify_frames(frame, (page_t)1 << order, 0);
+  frames_unused += (page_t)1 << order;
+  while (order < PM_ORDERS - 1) {
+    page_t buddy = frame ^ ((page_t)1 << order);
+
+    if (buddy >= total_physical_pages || free_order[buddy] != order + 1) {
+      break;
+    }
+    frame_list_del(order, buddy);
+    frame &= ~((page_t)1 << order);
+    order++;
+  }
+  frame_list_add(order, frame);
+}
+
+void init_frames() {
+  if ((free_order = calloc(total_physical_pages, sizeof(unsigned char))) == NULL) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  free_links = reserve_memory(total_physical_pages*sizeof(frame_link));
+  for (int order = 0; order < PM_ORDERS; order++) {
+    free_heads[order] = NO_FRAME;
+  }
+
+  // largest aligned blocks that fit, a single one for a power of two
+  for (page_t frame = 0; frame < total_physical_pages;) {
+    int order = PM_ORDERS - 1;
+    while ((frame & (((page_t)1 << order) - 1)) || frame + ((page_t)1 << order) > total_physical_pages) {
+      order--;
+    }
+    frame_list_add(order, frame);
+    frame += (page_t)1 << order;
+  }
+  frames_unused = total_physical_pages;
+}
+
+// page_req contiguous frames for a table, returns the one holding its first
+// entries: a table spans downwards from there. 0 if memory is exhausted.
+// Free frames are zero, so the table starts out with no valid entries
+page_t alloc_table(page_t page_req) {
+  int order = 0;
+  while (((page_t)1 << order) < page_req) {
+    order++;
+  }
+  page_t block = 0;
+  pthread_mutex_lock(&mem_manager.pm_lock);
+
+  // frames_free excludes those alloc_pages reserved for data
+  if (mem_manager.frames_free < page_req || frame_alloc(order, &block) == 0) {
+    pthread_mutex_unlock(&mem_manager.pm_lock);
+    return 0;
+  }
+  for (page_t frame = block + page_req; frame < block + ((page_t)1 << order); frame++) {
+    frame_free(frame, 0);
+  }
+  mem_manager.frames_free -= page_req;
+  mem_manager.page_frame_usage += page_req;
+  pthread_mutex_unlock(&mem_manager.pm_lock);
+  return block + page_req - 1;
+}
+
+address_space *get_space() {
+  return curr_space ? curr_space : &default_space;
+}
+
 void init_page_directories() {
-  mem_manager.dir_index = next_page_ref;
-  page_t old_ref = next_page_ref;
+  page_t frame = 0;
+  frame_alloc(0, &frame); // frame 0 backs vpn 0, which is never handed out
+  page_t *page_dir = NULL;
   for (int level = 0; level < VPN_LEVELS; level++) {
-    page_t page_req = vpn_pages[level];
-    for (page_t index = next_page_ref; index > (next_page_ref - page_req); index--) {
-      set_bit_at_index(&mem_manager.pm_bitmap, index);
-      set_hunk((page_t*)(mem_manager.pg_mem + (index*PAGE_SIZE)), PGFM_SET);
-    }
+    page_t table = alloc_table(vpn_pages[level]);
 
     if (level > 0) {
-      page_t next_page = ((next_page_ref << PG_LEN) | PGFM_VALID);
-      page_t *page_dir = (page_t*)(mem_manager.pg_mem + old_ref*PAGE_SIZE);
-      *page_dir |= next_page;
+      *page_dir |= ((table << PG_LEN) | PGFM_VALID);
+    } else {
+      default_space.dir_index = table;
+      mem_manager.spaces[0] = &default_space;
     }
-    old_ref = next_page_ref;
-    next_page_ref -= page_req;
-    mem_manager.frames_free -= page_req;
-    mem_manager.page_frame_usage += page_req;
+    page_dir = (page_t*)(mem_manager.pg_mem + table*PAGE_SIZE);
   }
   page_map(0, 0);
 }
 
-void reset_tlb_data(int pos) {
-  mem_lookup.table[pos].vpn = 0;
-  mem_lookup.table[pos].pfn = 0;
+void reset_tlb_data(tlb_data *entry) {
+  entry->vpn = 0;
+  entry->pfn = 0;
+  entry->last_used = 0;
+  entry->asid = 0;
 }
 
-void init_tlb() {
-  mem_lookup.count = mem_lookup.hit = mem_lookup.miss = 1;
-  for (int i = 0; i < TLB_ENTRIES; i++) {
-    reset_tlb_data(i);
+// runs at thread exit, the thread's counters are still readable then
+static void release_tlb(void *table) {
+  __atomic_add_fetch(&tlb_exited_count, mem_lookup.count, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&tlb_exited_miss, mem_lookup.miss, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&tlb_exited_walks, mem_lookup.walks, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&tlb_exited_skipped, mem_lookup.levels_skipped, __ATOMIC_RELAXED);
+  free(table);
+}
+
+static void create_tlb_key() {
+  pthread_key_create(&tlb_key, release_tlb);
+}
+
+void alloc_tlb(int sets, int ways) {
+  tlb_data *table = calloc((size_t)sets*ways, sizeof(tlb_data));
+
+  if (table == NULL) {
+    fprintf(stderr, "TLB allocation failed\n");
+    exit(EXIT_FAILURE);
   }
+  pthread_once(&tlb_key_once, create_tlb_key);
+  free(mem_lookup.table);
+  pthread_setspecific(tlb_key, table);
+  mem_lookup.table = table;
+  mem_lookup.sets = sets;
+  mem_lookup.ways = ways;
+  mem_lookup.epoch = __atomic_load_n(&tlb_epoch, __ATOMIC_ACQUIRE);
+  mem_lookup.clock = mem_lookup.count = mem_lookup.hit = mem_lookup.miss = 0;
+  mem_lookup.walks = mem_lookup.levels_skipped = 0;
 }
 
-void initialize_vm() {
-  if (init_vm) {
-    return;
+// a new address space with an empty root table, NULL if there is no asid
+// or frame left for it
+address_space *create_address_space() {
+  initialize_vm();
+  address_space *space = calloc(1, sizeof(address_space));
+
+  if (space == NULL) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  pthread_rwlock_wrlock(&mem_manager.pt_lock);
+  int asid = 1;
+  while (asid < MAX_ASIDS && mem_manager.spaces[asid]) {
+    asid++;
+  }
+
+  if (asid == MAX_ASIDS || (space->dir_index = alloc_table(vpn_pages[0])) == 0) {
+    pthread_rwlock_unlock(&mem_manager.pt_lock);
+    free(space);
+    return NULL;
+  }
+  space->asid = asid;
+  mem_manager.spaces[asid] = space;
+  pthread_rwlock_unlock(&mem_manager.pt_lock);
+  space->vm_free = new_vm_range(1, total_virtual_pages - 1);
+  return space;
+}
+
+// the calling thread works in space from now on, NULL for the default one;
+// TLB entries are tagged, nothing is flushed. Returns the previous space
+address_space *switch_address_space(address_space *space) {
+  address_space *prev = get_space();
+  curr_space = space;
+  return prev;
+}
+
+// called with pt_lock held, releases what a table maps, then the table;
+// returns the committed pages and table frames given back
+page_t free_table(page_t table, int level) {
+  page_t freed = vpn_pages[level];
+  for (page_t index = 0; index < ((page_t)1 << vpn_bits[level]); index++) {
+    page_t *page_dir = get_pt_entry(table, index);
+
+    if (*page_dir & PGFM_SWAPPED) {
+      pthread_mutex_lock(&mem_manager.pm_lock);
+      reset_bit_at_index(&mem_manager.swap_bitmap, (*page_dir) >> PG_LEN);
+      pthread_mutex_unlock(&mem_manager.pm_lock);
+      freed++;
+    } else if ((*page_dir & PGFM_VALID) && level < VPN_LEVELS - 1 && !(*page_dir & PGFM_HUGE)) {
+      freed += free_table((*page_dir) >> PG_LEN, level + 1);
+    } else if (*page_dir & PGFM_VALID) {
+      page_t frame = (*page_dir) >> PG_LEN;
+      int order = (*page_dir & PGFM_HUGE) ? huge_bits : 0;
+
+      if (frame_owner) {
+        __atomic_store_n(&frame_owner[frame], 0, __ATOMIC_RELAXED);
+      }
+      zero_frames(frame, (page_t)1 << order);
+      pthread_mutex_lock(&mem_manager.pm_lock);
+      frame_free(frame, order);
+      pthread_mutex_unlock(&mem_manager.pm_lock);
+      freed += (page_t)1 << order;
+    }
+  }
+
+  // the table's frames run downwards from table, they go back zeroed
+  page_t first = table + 1 - vpn_pages[level];
+  zero_frames(first, vpn_pages[level]);
+  pthread_mutex_lock(&mem_manager.pm_lock);
+  for (page_t frame = first; frame <= table; frame++) {
+    frame_free(frame, 0);
+  }
+  mem_manager.page_frame_usage -= vpn_pages[level];
+  pthread_mutex_unlock(&mem_manager.pm_lock);
+  return freed;
+}
+
+void free_vm_ranges(vm_range *range) {
+  if (range) {
+    free_vm_ranges(range->left);
+    free_vm_ranges(range->right);
+    free(range);
+  }
+}
+
+// frees every page and table of space, no thread may be working in it; a
+// thread destroying its own space goes back to the default one
+int destroy_address_space(address_space *space) {
+  if (space == NULL || space == &default_space) {
+    return -1;
+  }
+
+  if (curr_space == space) {
+    curr_space = NULL;
+  }
+  pthread_rwlock_wrlock(&mem_manager.pt_lock);
+  mem_manager.spaces[space->asid] = NULL;
+  page_t freed = free_table(space->dir_index, 0);
+  pthread_rwlock_unlock(&mem_manager.pt_lock);
+  pthread_mutex_lock(&mem_manager.pm_lock);
+  mem_manager.frames_free += freed;
+  pthread_mutex_unlock(&mem_manager.pm_lock);
+
+  // the asid and the table frames may be reused, no cache can keep them
+  __atomic_add_fetch(&tlb_epoch, 1, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&pwc_epoch, 1, __ATOMIC_RELEASE);
+  for (int bucket = 0; bucket < ALLOC_BUCKETS; bucket++) {
+    while (space->records[bucket]) {
+      alloc_record *record = space->records[bucket];
+      space->records[bucket] = record->next;
+      free(record->slab_page);
+      free(record);
+    }
+  }
+  free_vm_ranges(space->vm_free);
+  free(space);
+  return 0;
+}
+
+// only before the first t_malloc, the pool is reserved on initialization
+int set_physical_mem_size(size_t size) {
+  if (init_vm || size % PAGE_SIZE || size/PAGE_SIZE < PHYS_MIN_FRAMES ||
+      size/PAGE_SIZE > PHYS_MAX_FRAMES || size/PAGE_SIZE > ((page_t)-1 >> PG_LEN)) {
+    return -1;
   }
+  total_physical_pages = size/PAGE_SIZE;
+  return 0;
+}
+
+// sets has to be a power of two, ways = 1 gives a direct mapped TLB; applies
+// to the calling thread's TLB (flushing it) and to threads that start later
+int set_TLB_geometry(int sets, int ways) {
+  if (sets < 1 || ways < 1 || (sets & (sets - 1))) {
+    return -1;
+  }
+  tlb_sets = sets;
+  tlb_ways = ways;
+  alloc_tlb(sets, ways);
+  return 0;
+}
+
+// a thread's TLB is made on first use, and flushed when pages were freed
+void init_tlb() {
+  page_t epoch = __atomic_load_n(&tlb_epoch, __ATOMIC_ACQUIRE);
+
+  if (mem_lookup.table == NULL) {
+    alloc_tlb(tlb_sets, tlb_ways);
+  } else if (mem_lookup.epoch != epoch) {
+    memset(mem_lookup.table, 0,
+           sizeof(tlb_data)*mem_lookup.sets*mem_lookup.ways);
+    mem_lookup.epoch = epoch;
+  }
+}
+
+static void init_vm_once() {
   init_vbits();
   set_physical_mem();
   init_tlb();
@@ -116,15 +495,45 @@ void initialize_vm() {
   init_vm = true;
 }
 
-void set_physical_mem() {
-  mem_manager.pg_mem = (unsigned char*)malloc(MEMSIZE);
+void initialize_vm() {
+  pthread_once(&vm_once, init_vm_once);
+}
 
-  if (mem_manager.pg_mem == NULL) {
-    fprintf(stderr, "Physical Memory allocation failed\n");
+// pages beyond the frames go to a swap file, evicted by a clock hand;
+// only before the first t_malloc. The file is unlinked once open
+int set_swap_file(const char *path, size_t size) {
+  if (init_vm || path == NULL || size % (PAGE_SIZE*8) || size == 0) {
+    return -1;
+  }
+  swap_path = path;
+  swap_slots = size/PAGE_SIZE;
+  return 0;
+}
+
+void init_swap() {
+  mem_manager.swap_fd = open(swap_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+  if (mem_manager.swap_fd < 0 || ftruncate(mem_manager.swap_fd, swap_slots*PAGE_SIZE)) {
+    fprintf(stderr, "Swap file %s could not be created\n", swap_path);
     exit(EXIT_FAILURE);
   }
+  unlink(swap_path);
+  bitmap_init(&mem_manager.swap_bitmap, swap_slots);
+  frame_owner = reserve_memory(total_physical_pages*sizeof(page_t));
+  frame_asid = reserve_memory(total_physical_pages*sizeof(unsigned short));
+  frame_ref = reserve_memory(total_physical_pages);
+  mem_manager.frames_free += swap_slots; // pages committed may live in either
+}
+
+void set_physical_mem() {
+  mem_manager.pg_mem = reserve_memory(total_physical_pages*PAGE_SIZE);
   bitmap_init(&mem_manager.pm_bitmap, total_physical_pages);
-  bitmap_init(&mem_manager.vm_bitmap, total_virtual_pages);
+  init_frames();
+
+  if (swap_path) {
+    init_swap();
+  }
+  default_space.vm_free = new_vm_range(1, total_virtual_pages - 1); // vpn 0 is never handed out
 }
 
 void read_vpn_data(page_t vm_page, vp_data *vpn_data) {
@@ -138,268 +547,915 @@ void read_vpn_data(page_t vm_page, vp_data *vpn_data) {
   }
 }
 
-void invalidate_pm(page_t vpn) {
+// entry index of a table, the pages of a table run downwards from its frame
+page_t *get_pt_entry(page_t table, page_t index) {
+  page_t offset = index*PG_PTR_SIZE;
+  return (page_t*)(mem_manager.pg_mem + (table - offset/PAGE_SIZE)*PAGE_SIZE + offset%PAGE_SIZE);
+}
+
+// the virtual range is left to t_free, it is released once TLBs are flushed.
+// Returns the pages unmapped, a huge page goes at once from its first vpn
+page_t invalidate_pm(page_t vpn) {
   vp_data vpn_data;
   read_vpn_data((vpn << PG_LEN), &vpn_data);
-  page_t curr_index = mem_manager.dir_index;
-  page_t *page_dir;
+  pthread_rwlock_wrlock(&mem_manager.pt_lock);
+  page_t table = get_space()->dir_index;
+  page_t page_cnt = 1;
   for(int level = 0; level < VPN_LEVELS; level++) {
-    page_t index = vpn_data.indices[level]*PG_PTR_SIZE;
+    page_t *page_dir = get_pt_entry(table, vpn_data.indices[level]);
+
+    if (*page_dir & PGFM_SWAPPED) {
+      pthread_mutex_lock(&mem_manager.pm_lock);
+      reset_bit_at_index(&mem_manager.swap_bitmap, (*page_dir) >> PG_LEN);
+      pthread_mutex_unlock(&mem_manager.pm_lock);
+      *page_dir = PGFM_SET;
+    }
 
-    if (index >= PAGE_SIZE) {
-      curr_index -= index/PAGE_SIZE; // always contigious
-      index %= PAGE_SIZE;
+    if ((*page_dir & PGFM_VALID) == 0) {
+      break; // swapped out, or never mapped as alloc_pages ran out of frames
     }
-    page_dir = (page_t*)(mem_manager.pg_mem + curr_index*PAGE_SIZE + index);
-    curr_index = ((*page_dir) >> PG_LEN);
-    if (level == (VPN_LEVELS - 1)) {
+    table = ((*page_dir) >> PG_LEN);
+    int order = (*page_dir & PGFM_HUGE) ? huge_bits : 0;
+
+    if (level == (VPN_LEVELS - 1) || order) {
       *page_dir = PGFM_SET; // invalidate the last level pm bit
-      reset_bit_at_index(&mem_manager.vm_bitmap, vpn);
-      reset_bit_at_index(&mem_manager.pm_bitmap, curr_index);
-      page_dir = (page_t*)(mem_manager.pg_mem + curr_index*PAGE_SIZE);
-      set_hunk(page_dir, 0);
+      page_cnt = (page_t)1 << order;
+
+      if (frame_owner) {
+        __atomic_store_n(&frame_owner[table], 0, __ATOMIC_RELAXED);
+      }
+      zero_frames(table, page_cnt);
+      pthread_mutex_lock(&mem_manager.pm_lock);
+      frame_free(table, order);
+      pthread_mutex_unlock(&mem_manager.pm_lock);
+      break;
+    }
+  }
+  pthread_rwlock_unlock(&mem_manager.pt_lock);
+  return page_cnt;
+}
+
+// turns the huge page holding vpn into a last level table of its frames, so
+// part of it can be unmapped; -1 if there is no frame for the table
+int split_huge(page_t vpn) {
+  vp_data vpn_data;
+  read_vpn_data((vpn << PG_LEN), &vpn_data);
+  pthread_rwlock_wrlock(&mem_manager.pt_lock);
+  page_t table = get_space()->dir_index;
+  for(int level = 0; level < VPN_LEVELS - 1; level++) {
+    page_t *page_dir = get_pt_entry(table, vpn_data.indices[level]);
+
+    if ((*page_dir & PGFM_VALID) == 0) {
+      break;
+    }
+    table = ((*page_dir) >> PG_LEN);
+
+    if (*page_dir & PGFM_HUGE) {
+      page_t leaf = alloc_table(vpn_pages[VPN_LEVELS - 1]);
+
+      if (leaf == 0) {
+        pthread_rwlock_unlock(&mem_manager.pt_lock);
+        return -1;
+      }
+      for (page_t index = 0; index < ((page_t)1 << huge_bits); index++) {
+        *get_pt_entry(leaf, index) = ((table + index) << PG_LEN) | PGFM_VALID;
+      }
+      *page_dir = (leaf << PG_LEN) | PGFM_VALID;
+      break;
     }
   }
+  pthread_rwlock_unlock(&mem_manager.pt_lock);
+  return 0;
 }
 
+// faults a swapped out page back in; with swap on, the frame returned may be
+// evicted again unless swap_lock is held as access_memory does
 void *translate(page_t vpn) {
+  bool is_swapped = false;
+  void *physical_address = walk_translate(vpn, &is_swapped);
+  while (physical_address == NULL && is_swapped && swap_in(vpn >> PG_LEN) == 0) {
+    physical_address = walk_translate(vpn, &is_swapped);
+  }
+  return physical_address;
+}
+
+// translate without faults, is_swapped tells a swapped out page from a hole
+void *walk_translate(page_t vpn, bool *is_swapped) {
   vp_data vpn_data;
   read_vpn_data(vpn, &vpn_data);
 
-  if (get_bit_at_index(mem_manager.vm_bitmap, vpn_data.vpn) == 0) {
-    return NULL;
-  }
   page_t pfn = check_TLB((vpn >> PG_LEN));
+  *is_swapped = false;
 
   if ((pfn & PGFM_VALID) > 0) {
+    if (frame_ref) {
+      frame_ref[pfn >> PG_LEN] = 1;
+    }
     page_t offset = vpn & (PAGE_SIZE - 1);
     page_t physical_addr = ((pfn >> PG_LEN) << PG_LEN) | offset;
     return (void *)physical_addr;
   }
-  page_t dir_indices = mem_manager.dir_index;
-  page_t *page_dir;
-  int level = 0;
-  for(; level < VPN_LEVELS; level++) {
-    page_t index = vpn_data.indices[level]*PG_PTR_SIZE;
-
+  pthread_rwlock_rdlock(&mem_manager.pt_lock);
+  page_t dir_indices = get_space()->dir_index;
+  // resumes at the deepest table a recent walk went through
+  for(int level = find_PWC(vpn_data.vpn, &dir_indices); level < VPN_LEVELS; level++) {
+    page_t *page_dir = get_pt_entry(dir_indices, vpn_data.indices[level]);
 
-    if (index >= PAGE_SIZE) {
-      dir_indices -= index/PAGE_SIZE; // always contigious
-      index %= PAGE_SIZE;
+    if ((*page_dir & PGFM_VALID) == 0) {
+      *is_swapped = (*page_dir & PGFM_SWAPPED) != 0;
+      pthread_rwlock_unlock(&mem_manager.pt_lock);
+      return NULL; // not mapped
     }
-    page_dir = (page_t*)(mem_manager.pg_mem + dir_indices*PAGE_SIZE + index);
     dir_indices = (*page_dir >> PG_LEN);
+
+    if (level < VPN_LEVELS - 1 && (*page_dir & PGFM_HUGE) == 0) {
+      add_PWC(vpn_data.vpn, level + 1, dir_indices);
+    }
+
+    if (*page_dir & PGFM_HUGE) {
+      // the walk ends here, the frames of a huge page are contiguous
+      pthread_rwlock_unlock(&mem_manager.pt_lock);
+      add_TLB_huge(vpn_data.vpn, dir_indices);
+      dir_indices += vpn_data.indices[VPN_LEVELS - 1];
+      return (void *)((dir_indices << PG_LEN) | vpn_data.offset);
+    }
   }
+  pthread_rwlock_unlock(&mem_manager.pt_lock);
   add_TLB(vpn_data.vpn, dir_indices);
+
+  if (frame_ref) {
+    frame_ref[dir_indices] = 1;
+  }
   page_t physical_address =
       ((dir_indices << PG_LEN) | vpn_data.offset);
   return (void *)physical_address;
 }
 
-void page_map(page_t vpn, page_t pm_frame) {
+// the last level entry of vpn under root, called with pt_lock held; NULL
+// without one
+page_t *get_leaf_entry(page_t root, page_t vpn) {
   vp_data vpn_data;
-  page_t dir_indices = mem_manager.dir_index;
-  read_vpn_data(vpn << PG_LEN, &vpn_data);
-  page_t *page_dir;
-  for(int level = 0; level < VPN_LEVELS; level++) {
-    page_t index = vpn_data.indices[level]*PG_PTR_SIZE;
+  read_vpn_data((vpn << PG_LEN), &vpn_data);
+  page_t table = root;
+  for(int level = 0; level < VPN_LEVELS - 1; level++) {
+    page_t *page_dir = get_pt_entry(table, vpn_data.indices[level]);
 
-    if (index >= PAGE_SIZE) {
-      dir_indices -= index/PAGE_SIZE;
-      index %= PAGE_SIZE;
+    if ((*page_dir & PGFM_VALID) == 0 || (*page_dir & PGFM_HUGE)) {
+      return NULL;
     }
-    page_dir = (page_t*)(mem_manager.pg_mem + (page_t)dir_indices*PAGE_SIZE + index);
+    table = ((*page_dir) >> PG_LEN);
+  }
+  return get_pt_entry(table, vpn_data.indices[VPN_LEVELS - 1]);
+}
 
-    if (level == (VPN_LEVELS - 1)) {
-      *page_dir |= ((pm_frame << PG_LEN) | PGFM_VALID);
-      set_bit_at_index(&mem_manager.vm_bitmap, vpn);
-      set_bit_at_index(&mem_manager.pm_bitmap, pm_frame);
-    } else if (*page_dir & PGFM_VALID) {
-      dir_indices = (*page_dir >> PG_LEN); // reuse if already valid
-    } else {
-      page_t len = 0;
-      for (page_t pos = next_page_ref; pos >= 0 && len < vpn_pages[(level + 1)]; pos--) {
-        if (get_bit_at_index(mem_manager.pm_bitmap, pos) == 0) {
-          if (len == 0) {
-            next_page_ref = pos;
-          }
-          len++;
-        } else {
-          len = 0;
-        }
-      }
-      for (page_t pos = next_page_ref; pos < (next_page_ref - len); pos--) {
-        set_bit_at_index(&mem_manager.pm_bitmap, pos);
-        set_hunk((page_t*)(mem_manager.pg_mem + (pos*PAGE_SIZE)), PGFM_SET);
-      }
-      *page_dir |= ((next_page_ref << PG_LEN) | PGFM_VALID);
-      dir_indices = next_page_ref;
-      next_page_ref -= len;
-      mem_manager.frames_free -= len;
-      mem_manager.page_frame_usage += len;
+double elapsed_secs(struct timespec *start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec)/1e9;
+}
+
+// called with pm_lock held, the next free swap slot from the cursor
+int swap_slot_alloc(page_t *slot) {
+  for (page_t i = 0; i < swap_slots; i++) {
+    page_t pos = (swap_cursor + i) % swap_slots;
+
+    if (get_bit_at_index(mem_manager.swap_bitmap, pos) == 0) {
+      set_bit_at_index(&mem_manager.swap_bitmap, pos);
+      swap_cursor = pos + 1;
+      *slot = pos;
+      return 1;
     }
   }
-  add_TLB(vpn_data.vpn, pm_frame);
-  return;
+  return 0;
 }
 
-int get_vm_start_page(int page_cnt, page_t *start_page) {
-  int frame_cnt = 0;
-  page_t vpn_start = 1;
-  int new_available = -1;\
-  int available = 0;
-  unsigned char *vm_bm;
-  for (page_t vpn = 0; vpn < mem_manager.vm_bitmap->num_bytes && frame_cnt < page_cnt;) {
-    vm_bm = mem_manager.vm_bitmap->bits + vpn;
+// called with swap_lock held exclusively. Clock, second chance: a frame
+// translated since the hand last passed is spared once. -1 if none can go
+int evict_frame() {
+  pthread_rwlock_wrlock(&mem_manager.pt_lock);
+  for (page_t step = 0; step < 2*total_physical_pages; step++) {
+    page_t frame = clock_hand;
+    clock_hand = (clock_hand + 1) % total_physical_pages;
+    page_t owner = __atomic_load_n(&frame_owner[frame], __ATOMIC_RELAXED);
+    address_space *space = mem_manager.spaces[frame_asid[frame]];
+    page_t *page_dir = (owner && space) ? get_leaf_entry(space->dir_index, owner - 1) : NULL;
 
-    if (new_available != -1) {
-      available = new_available;
-      new_available = -1;
-    } else {
-      available = __builtin_ctz(~(*vm_bm));
+    if (page_dir == NULL || (*page_dir & PGFM_VALID) == 0 || (*page_dir >> PG_LEN) != frame) {
+      continue; // not a mapped data frame, or one still being mapped
     }
 
-    if (available < 8) {
-      page_t vpn_bit = (vpn*8) + available;
+    if (frame_ref[frame]) {
+      frame_ref[frame] = 0;
+      continue;
+    }
+    page_t slot = 0;
+    pthread_mutex_lock(&mem_manager.pm_lock);
+    int has_slot = swap_slot_alloc(&slot);
+    pthread_mutex_unlock(&mem_manager.pm_lock);
 
-      if (frame_cnt == 0) {
-        vpn_start = vpn_bit;
-      }
-      for (; vpn_bit < total_virtual_pages && frame_cnt < page_cnt; vpn_bit++, frame_cnt++) {
-        if (get_bit_at_index(mem_manager.vm_bitmap, vpn_bit)) {
-          frame_cnt = 0; // if mem not contiguous, repeat
-          new_available = (vpn_bit%8) + 1;
-          vpn = vpn_bit/8;
-
-          if (new_available == 8) {
-            new_available = 0;
-            vpn++;
-          }
-          break;
-        }
-      }
-    } else {
-      vpn++;
+    if (has_slot == 0) {
+      break;
     }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-    if (page_cnt == frame_cnt) {
-      *start_page = vpn_start;
-      return 1;
+    if (pwrite(mem_manager.swap_fd, mem_manager.pg_mem + frame*PAGE_SIZE, PAGE_SIZE,
+               (off_t)(slot*PAGE_SIZE)) != PAGE_SIZE) {
+      fprintf(stderr, "Swap out of frame %lu failed\n", (unsigned long)frame);
+      exit(EXIT_FAILURE);
+    }
+    swap_out_secs += elapsed_secs(&start);
+    swap_outs++;
+    *page_dir = (slot << PG_LEN) | PGFM_SWAPPED;
+    frame_owner[frame] = 0;
+    zero_frames(frame, 1);
+    pthread_mutex_lock(&mem_manager.pm_lock);
+    frame_free(frame, 0);
+    pthread_mutex_unlock(&mem_manager.pm_lock);
+    pthread_rwlock_unlock(&mem_manager.pt_lock);
+
+    // every TLB may still hold the old frame
+    if (space == get_space()) {
+      remove_TLB(owner - 1);
     }
+    __atomic_add_fetch(&tlb_epoch, 1, __ATOMIC_RELEASE);
+    return 0;
   }
-  return 0;
+  pthread_rwlock_unlock(&mem_manager.pt_lock);
+  return -1;
 }
 
-page_t get_page_count(size_t n) {
-  page_t page_cnt = n/PAGE_SIZE;
+// called with swap_lock held exclusively, a data frame for vpn, evicting
+// others first so page tables still find free frames
+int claim_data_frame(page_t vpn, page_t *frame) {
+  pthread_mutex_lock(&mem_manager.pm_lock);
+  while (frames_unused < SWAP_LOW_FRAMES) {
+    pthread_mutex_unlock(&mem_manager.pm_lock);
 
-  if ((n % PAGE_SIZE) > 0) {
-    page_cnt++;
+    if (evict_frame()) {
+      return 0;
+    }
+    pthread_mutex_lock(&mem_manager.pm_lock);
   }
-  return page_cnt;
+  int is_alloc = frame_alloc(0, frame);
+  pthread_mutex_unlock(&mem_manager.pm_lock);
+
+  if (is_alloc) {
+    frame_asid[*frame] = get_space()->asid;
+    __atomic_store_n(&frame_owner[*frame], vpn + 1, __ATOMIC_RELAXED);
+  }
+  return is_alloc;
 }
 
-void *t_malloc(size_t n) {
-  initialize_vm();
-  page_t page_cnt = get_page_count(n);
+// reads a swapped out page back into a frame, -1 if that is not possible
+int swap_in(page_t vpn) {
+  page_t frame = 0;
+  pthread_rwlock_wrlock(&mem_manager.swap_lock);
 
-  if (mem_manager.frames_free < page_cnt) {
-    return NULL; // insufficient memory available
+  if (claim_data_frame(vpn, &frame) == 0) {
+    pthread_rwlock_unlock(&mem_manager.swap_lock);
+    return -1;
   }
-  page_t vpn_start = 0;
+  pthread_rwlock_wrlock(&mem_manager.pt_lock);
+  page_t *page_dir = get_leaf_entry(get_space()->dir_index, vpn);
+  int ret = -1;
 
-  if (get_vm_start_page(page_cnt, &vpn_start) == 0) {
-    return NULL;
-  }
-  page_t frame_cnt = 0;
-  page_t vpn = vpn_start;
-  page_t pm_index = 0;
-  for (; vpn < (vpn_start + page_cnt) && (frame_cnt < page_cnt) && (pm_index < next_page_ref); pm_index++) {
-    unsigned char *pm_bm = mem_manager.pm_bitmap->bits + pm_index;
-    int available = __builtin_ctz(~(*pm_bm));
-
-    if (available < 8) {
-      for (int pm_j_index = available; pm_j_index < 8 && (frame_cnt < page_cnt); pm_j_index++) {
-        page_t pm_frame = (pm_index*8) + pm_j_index;
-        if (get_bit_at_index(mem_manager.pm_bitmap, pm_frame) == 0) {
-          page_map(vpn, pm_frame);
-          mem_manager.frames_free--;
-          frame_cnt++;
-          vpn++;
-        }
-      }
+  if (page_dir && (*page_dir & PGFM_SWAPPED)) {
+    page_t slot = *page_dir >> PG_LEN;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (pread(mem_manager.swap_fd, mem_manager.pg_mem + frame*PAGE_SIZE, PAGE_SIZE,
+              (off_t)(slot*PAGE_SIZE)) != PAGE_SIZE) {
+      fprintf(stderr, "Swap in of page %lu failed\n", (unsigned long)vpn);
+      exit(EXIT_FAILURE);
     }
+    swap_in_secs += elapsed_secs(&start);
+    swap_ins++;
+    *page_dir = (frame << PG_LEN) | PGFM_VALID;
+    frame_ref[frame] = 1;
+    pthread_mutex_lock(&mem_manager.pm_lock);
+    reset_bit_at_index(&mem_manager.swap_bitmap, slot);
+    pthread_mutex_unlock(&mem_manager.pm_lock);
+    ret = 0;
+  } else {
+    frame_owner[frame] = 0; // freed, or another thread brought it in
+    pthread_mutex_lock(&mem_manager.pm_lock);
+    frame_free(frame, 0);
+    pthread_mutex_unlock(&mem_manager.pm_lock);
+    ret = (page_dir && (*page_dir & PGFM_VALID)) ? 0 : -1;
   }
-  page_t virtual_address = vpn_start << PG_LEN;
-  return (void *)virtual_address;
+  pthread_rwlock_unlock(&mem_manager.pt_lock);
+  pthread_rwlock_unlock(&mem_manager.swap_lock);
+  return ret;
 }
 
-int t_free(page_t vm_page, size_t n) {
-  page_t page_cnt = get_page_count(n);
-  page_t start_page = vm_page >> PG_LEN;
-  bool is_invalid = false;
-  page_t vpn = start_page;
-  for (; vpn < (start_page + page_cnt); vpn++) {
-    if (get_bit_at_index(mem_manager.vm_bitmap, vpn) == 0) {
-      is_invalid = true;
-      break;
+// sets the entry for vpn at leaf_level, making the tables above it; -1 when
+// out of frames, or when a huge page would cover an existing table
+int map_entry(page_t vpn, page_t entry, int leaf_level) {
+  vp_data vpn_data;
+  read_vpn_data(vpn << PG_LEN, &vpn_data);
+  pthread_rwlock_wrlock(&mem_manager.pt_lock);
+  page_t dir_indices = get_space()->dir_index;
+  page_t *page_dir;
+  for(int level = 0; level < leaf_level; level++) {
+    page_dir = get_pt_entry(dir_indices, vpn_data.indices[level]);
+
+    if ((*page_dir & PGFM_VALID) == 0) {
+      page_t table = alloc_table(vpn_pages[(level + 1)]);
+
+      if (table == 0) {
+        pthread_rwlock_unlock(&mem_manager.pt_lock);
+        return -1; // no frames left for a page table
+      }
+      *page_dir = ((table << PG_LEN) | PGFM_VALID);
     }
+    dir_indices = (*page_dir >> PG_LEN); // reuse if already valid
   }
+  page_dir = get_pt_entry(dir_indices, vpn_data.indices[leaf_level]);
 
-  if (is_invalid) {
+  if (*page_dir & PGFM_VALID) {
+    pthread_rwlock_unlock(&mem_manager.pt_lock);
     return -1;
   }
-  for (vpn = start_page; vpn < (start_page + page_cnt); vpn++) {
-    invalidate_pm(vpn);
-    remove_TLB(vpn);
-  }
-  mem_manager.frames_free += page_cnt;
+  *page_dir = entry;
+  pthread_rwlock_unlock(&mem_manager.pt_lock);
   return 0;
 }
 
-void copy_data(unsigned char *dest, const unsigned char *src, size_t n) {
-  for (size_t i = 0; i < n; i++) {
-    *(dest+i) = *(src+i);
+int page_map(page_t vpn, page_t pm_frame) {
+  if (map_entry(vpn, (pm_frame << PG_LEN) | PGFM_VALID, VPN_LEVELS - 1)) {
+    return -1;
   }
+  add_TLB(vpn, pm_frame);
+  return 0;
 }
 
-int access_memory(page_t vm_page, void *val, size_t n, bool read) {
-  page_t page_cnt = get_page_count(n);
+// 1 << huge_bits pages from vpn, aligned to that, onto frames from pm_frame
+int page_map_huge(page_t vpn, page_t pm_frame) {
+  return map_entry(vpn, (pm_frame << PG_LEN) | PGFM_VALID | PGFM_HUGE, VPN_LEVELS - 2);
+}
 
-  if (page_cnt > total_physical_pages || page_cnt > mem_manager.frames_free) {
-    return -1;
-  }
-  page_t vm_start = vm_page >> PG_LEN;
-  page_t vm_end = vm_start + page_cnt;
-  page_t rw_opr = n;
-  unsigned char *p_val = val;
-  for (page_t vm_index = vm_start; vm_index < total_virtual_pages && rw_opr > 0; vm_index++) {
-    void *pm_index = (page_t*)((page_t)translate((vm_index << PG_LEN)) >> PG_LEN);
-    unsigned char *m_val = (mem_manager.pg_mem + ((page_t)pm_index*PAGE_SIZE));
-    page_t rw_data = PAGE_SIZE;
+vm_range *new_vm_range(page_t start, page_t len) {
+  vm_range *range = malloc(sizeof(vm_range));
 
-    if (pm_index == NULL) {
-      return 0;
+  if (range == NULL) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  range->start = start;
+  range->len = len;
+  range->max_len = len;
+  range->prio = rand_r(&vm_range_seed);
+  range->left = NULL;
+  range->right = NULL;
+  return range;
+}
+
+void update_vm_range(vm_range *range) {
+  range->max_len = range->len;
+  if (range->left && range->left->max_len > range->max_len) {
+    range->max_len = range->left->max_len;
+  }
+  if (range->right && range->right->max_len > range->max_len) {
+    range->max_len = range->right->max_len;
+  }
+}
+
+// ranges starting before start go to left, the rest to right
+void split_vm_range(vm_range *range, page_t start, vm_range **left, vm_range **right) {
+  if (range == NULL) {
+    *left = *right = NULL;
+  } else if (range->start < start) {
+    split_vm_range(range->right, start, &range->right, right);
+    *left = range;
+    update_vm_range(range);
+  } else {
+    split_vm_range(range->left, start, left, &range->left);
+    *right = range;
+    update_vm_range(range);
+  }
+}
+
+// every range in left starts before those in right
+vm_range *merge_vm_range(vm_range *left, vm_range *right) {
+  if (left == NULL || right == NULL) {
+    return left ? left : right;
+  }
+
+  if (left->prio > right->prio) {
+    left->right = merge_vm_range(left->right, right);
+    update_vm_range(left);
+    return left;
+  }
+  right->left = merge_vm_range(left, right->left);
+  update_vm_range(right);
+  return right;
+}
+
+// carves page_cnt pages off the front of the lowest range that holds them
+vm_range *take_vm_range(vm_range *range, page_t page_cnt, page_t *start_page) {
+  if (range->left && range->left->max_len >= page_cnt) {
+    range->left = take_vm_range(range->left, page_cnt, start_page);
+  } else if (range->len >= page_cnt) {
+    *start_page = range->start;
+    range->start += page_cnt;
+    range->len -= page_cnt;
+
+    if (range->len == 0) {
+      vm_range *rest = merge_vm_range(range->left, range->right);
+      free(range);
+      return rest;
+    }
+  } else {
+    range->right = take_vm_range(range->right, page_cnt, start_page);
+  }
+  update_vm_range(range);
+  return range;
+}
+
+// called with vm_lock held, the range found is taken
+int get_vm_start_page(page_t page_cnt, page_t *start_page) {
+  address_space *space = get_space();
+
+  if (space->vm_free == NULL || space->vm_free->max_len < page_cnt) {
+    return 0;
+  }
+  space->vm_free = take_vm_range(space->vm_free, page_cnt, start_page);
+  return 1;
+}
+
+// called with vm_lock held, like get_vm_start_page for a start that is a
+// multiple of align; the pages around it are given back
+int get_vm_aligned_pages(page_t page_cnt, page_t align, page_t *start_page) {
+  page_t start = 0;
+
+  if (get_vm_start_page(page_cnt + align - 1, &start) == 0) {
+    return 0;
+  }
+  *start_page = (start + align - 1) & ~(align - 1);
+
+  if (*start_page > start) {
+    release_vm_range(start, *start_page - start);
+  }
+
+  if (start + align - 1 > *start_page) {
+    release_vm_range(*start_page + page_cnt, start + align - 1 - *start_page);
+  }
+  return 1;
+}
+
+// called with vm_lock held, joins the free neighbours of the range
+void release_vm_range(page_t start_page, page_t page_cnt) {
+  vm_range *left, *right, *side;
+  split_vm_range(get_space()->vm_free, start_page, &left, &right);
+  vm_range *prev = left;
+  while (prev && prev->right) {
+    prev = prev->right;
+  }
+
+  if (prev && prev->start + prev->len == start_page) {
+    split_vm_range(left, prev->start, &left, &side);
+    start_page = prev->start;
+    page_cnt += prev->len;
+    free(side);
+  }
+  vm_range *next = right;
+  while (next && next->left) {
+    next = next->left;
+  }
+
+  if (next && next->start == start_page + page_cnt) {
+    split_vm_range(right, next->start + 1, &side, &right);
+    page_cnt += next->len;
+    free(side);
+  }
+  get_space()->vm_free = merge_vm_range(merge_vm_range(left, new_vm_range(start_page, page_cnt)), right);
+}
+
+// called with vm_lock held, true if no page of the range is free
+bool is_vm_range_used(page_t start_page, page_t page_cnt) {
+  vm_range *range = get_space()->vm_free;
+  while (range) {
+    if (range->start >= start_page + page_cnt) {
+      range = range->left;
+    } else if (range->start + range->len <= start_page) {
+      range = range->right;
+    } else {
+      return false;
+    }
+  }
+  return start_page > 0 && start_page + page_cnt <= total_virtual_pages;
+}
+
+page_t get_page_count(size_t n) {
+  page_t page_cnt = n/PAGE_SIZE;
+
+  if ((n % PAGE_SIZE) > 0) {
+    page_cnt++;
+  }
+  return page_cnt;
+}
+
+// maps page_cnt fresh pages, returns the first vpn or 0 if there is no room
+page_t alloc_pages(page_t page_cnt) {
+  pthread_mutex_lock(&mem_manager.pm_lock);
+  if (mem_manager.frames_free < page_cnt) {
+    pthread_mutex_unlock(&mem_manager.pm_lock);
+    return 0; // insufficient memory available
+  }
+  mem_manager.frames_free -= page_cnt; // reserved, picked one by one below
+  pthread_mutex_unlock(&mem_manager.pm_lock);
+  page_t vpn_start = 0;
+  page_t huge_cnt = (page_t)1 << huge_bits;
+  // aligned, so it can use huge pages; those are never evicted, so not with swap
+  bool is_huge = page_cnt >= huge_cnt && mem_manager.swap_fd < 0;
+
+  // the range is marked taken before it is mapped, so no one else gets it
+  pthread_mutex_lock(&mem_manager.vm_lock);
+  int is_found = is_huge ? get_vm_aligned_pages(page_cnt, huge_cnt, &vpn_start)
+                         : get_vm_start_page(page_cnt, &vpn_start);
+  pthread_mutex_unlock(&mem_manager.vm_lock);
+
+  if (is_found == 0) {
+    pthread_mutex_lock(&mem_manager.pm_lock);
+    mem_manager.frames_free += page_cnt;
+    pthread_mutex_unlock(&mem_manager.pm_lock);
+    return 0;
+  }
+  page_t vpn = vpn_start;
+  // with swap, page by page so every frame can be evicted on its own
+  while (mem_manager.swap_fd >= 0 && vpn < (vpn_start + page_cnt)) {
+    page_t frame = 0;
+    pthread_rwlock_wrlock(&mem_manager.swap_lock);
+    int is_alloc = claim_data_frame(vpn, &frame);
+    pthread_rwlock_unlock(&mem_manager.swap_lock);
+
+    if (is_alloc == 0 || page_map(vpn, frame)) {
+      if (is_alloc) {
+        frame_owner[frame] = 0;
+        pthread_mutex_lock(&mem_manager.pm_lock);
+        frame_free(frame, 0);
+        pthread_mutex_unlock(&mem_manager.pm_lock);
+      }
+      break;
+    }
+    vpn++;
+  }
+  while (mem_manager.swap_fd < 0 && vpn < (vpn_start + page_cnt)) {
+    page_t span = vpn_start + page_cnt - vpn;
+
+    if (is_huge && (vpn % huge_cnt) == 0 && span >= huge_cnt) {
+      page_t block = 0;
+      pthread_mutex_lock(&mem_manager.pm_lock);
+      int is_alloc = frame_alloc(huge_bits, &block);
+      pthread_mutex_unlock(&mem_manager.pm_lock);
+
+      if (is_alloc && page_map_huge(vpn, block) == 0) {
+        vpn += huge_cnt;
+        continue;
+      }
+
+      if (is_alloc) {
+        pthread_mutex_lock(&mem_manager.pm_lock);
+        frame_free(block, huge_bits);
+        pthread_mutex_unlock(&mem_manager.pm_lock);
+      }
+    }
+
+    // else the biggest blocks that fit, up to the next huge page boundary
+    if (is_huge && span > huge_cnt - (vpn % huge_cnt)) {
+      span = huge_cnt - (vpn % huge_cnt);
+    }
+    int order = 0;
+    while (order < PM_ORDERS - 1 && ((page_t)2 << order) <= span) {
+      order++;
+    }
+    page_t block = 0;
+    pthread_mutex_lock(&mem_manager.pm_lock);
+    while (frame_alloc(order, &block) == 0 && order > 0) {
+      order--;
+    }
+    pthread_mutex_unlock(&mem_manager.pm_lock);
+
+    if (block == 0) {
+      break;
+    }
+    page_t frame = block;
+    for (; frame < block + ((page_t)1 << order) && page_map(vpn, frame) == 0; frame++) {
+      vpn++;
+    }
+
+    if (frame < block + ((page_t)1 << order)) {
+      pthread_mutex_lock(&mem_manager.pm_lock);
+      for (; frame < block + ((page_t)1 << order); frame++) {
+        frame_free(frame, 0);
+      }
+      pthread_mutex_unlock(&mem_manager.pm_lock);
+      break;
+    }
+  }
+
+  if (vpn < (vpn_start + page_cnt)) {
+    free_pages(vpn_start, page_cnt); // unmaps what was mapped, ends the reservation
+    return 0;
+  }
+  return vpn_start;
+}
+
+alloc_record *find_record(page_t vpn) {
+  alloc_record *record = get_space()->records[vpn % ALLOC_BUCKETS];
+  while (record && record->vpn != vpn) {
+    record = record->next;
+  }
+  return record;
+}
+
+// the allocation holding vpn; one that does not start at vpn is only found by
+// a scan of every bucket, freeing part of an allocation is rare
+alloc_record *find_covering_record(page_t vpn) {
+  alloc_record *record = find_record(vpn);
+  for (int bucket = 0; record == NULL && bucket < ALLOC_BUCKETS; bucket++) {
+    record = get_space()->records[bucket];
+    while (record && (vpn < record->vpn || vpn >= record->vpn + record->page_cnt)) {
+      record = record->next;
+    }
+  }
+  return record;
+}
+
+void add_record(page_t vpn, page_t page_cnt, slab *slab_page) {
+  alloc_record *record = malloc(sizeof(alloc_record));
+
+  if (record == NULL) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  record->vpn = vpn;
+  record->page_cnt = page_cnt;
+  record->slab_page = slab_page;
+  record->next = get_space()->records[vpn % ALLOC_BUCKETS];
+  get_space()->records[vpn % ALLOC_BUCKETS] = record;
+}
+
+void remove_record(page_t vpn) {
+  alloc_record **link = &get_space()->records[vpn % ALLOC_BUCKETS];
+  while (*link && (*link)->vpn != vpn) {
+    link = &(*link)->next;
+  }
+
+  if (*link) {
+    alloc_record *record = *link;
+    *link = record->next;
+    free(record);
+  }
+}
+
+int get_slab_class(size_t n) {
+  int size_class = 0;
+  while ((SLAB_MIN_SIZE << size_class) < n) {
+    size_class++;
+  }
+  return size_class;
+}
+
+// objects of one size class packed into a page, called with alloc_lock held
+void *slab_alloc(size_t n) {
+  int size_class = get_slab_class(n);
+  page_t obj_size = SLAB_MIN_SIZE << size_class;
+  slab **slab_partial = get_space()->slab_partial;
+  slab *slab_page = slab_partial[size_class];
+
+  if (slab_page == NULL) {
+    page_t vpn = alloc_pages(1);
+
+    if (vpn == 0) {
+      return NULL;
+    }
+
+    if ((slab_page = calloc(1, sizeof(slab))) == NULL) {
+      fprintf(stderr, "Memory allocation failed\n");
+      exit(EXIT_FAILURE);
+    }
+    slab_page->vpn = vpn;
+    slab_page->size_class = size_class;
+    slab_partial[size_class] = slab_page;
+    add_record(vpn, 1, slab_page);
+  }
+  int obj = 0;
+  for (int word = 0; word < SLAB_MAP_WORDS; word++) {
+    if (~slab_page->used_map[word]) {
+      obj = word*64 + __builtin_ctzll(~slab_page->used_map[word]);
+      slab_page->used_map[word] |= 1ULL << (obj % 64);
+      break;
+    }
+  }
+
+  if (++slab_page->used == PAGE_SIZE/obj_size) {
+    slab_partial[size_class] = slab_page->next; // full, off the partial list
+    slab_page->next = NULL;
+  }
+  page_t virtual_address = (slab_page->vpn << PG_LEN) + obj*obj_size;
+  return (void *)virtual_address;
+}
+
+int slab_free(slab *slab_page, page_t vm_page) {
+  page_t obj_size = SLAB_MIN_SIZE << slab_page->size_class;
+  page_t offset = vm_page & (PAGE_SIZE - 1);
+  int obj = offset/obj_size;
+
+  if ((offset % obj_size) || !(slab_page->used_map[obj/64] & (1ULL << (obj % 64)))) {
+    return -1;
+  }
+  slab_page->used_map[obj/64] &= ~(1ULL << (obj % 64));
+  slab **link = &get_space()->slab_partial[slab_page->size_class];
+
+  if (slab_page->used-- == PAGE_SIZE/obj_size) {
+    slab_page->next = *link; // was full, has room again
+    *link = slab_page;
+  }
+
+  if (slab_page->used == 0) {
+    while (*link != slab_page) {
+      link = &(*link)->next;
+    }
+    *link = slab_page->next;
+    remove_record(slab_page->vpn);
+    free_pages(slab_page->vpn, 1);
+    free(slab_page);
+  }
+  return 0;
+}
+
+// requests up to SLAB_MAX_SIZE share pages, larger ones get whole pages
+void *t_malloc(size_t n) {
+  initialize_vm();
+
+  if (n <= SLAB_MAX_SIZE) {
+    pthread_mutex_lock(&alloc_lock);
+    void *virtual_address = slab_alloc(n);
+    pthread_mutex_unlock(&alloc_lock);
+    return virtual_address;
+  }
+  page_t page_cnt = get_page_count(n);
+  page_t vpn_start = alloc_pages(page_cnt);
+
+  if (vpn_start == 0) {
+    return NULL;
+  }
+  pthread_mutex_lock(&alloc_lock);
+  add_record(vpn_start, page_cnt, NULL);
+  pthread_mutex_unlock(&alloc_lock);
+  page_t virtual_address = vpn_start << PG_LEN;
+  return (void *)virtual_address;
+}
+
+/*
+ * n = 0 frees the whole allocation at vm_page, its size is known from
+ * t_malloc. A non zero n keeps the old behaviour of freeing n bytes worth of
+ * pages from vm_page, anywhere inside one allocation: what is left before
+ * and after the pages stays allocated.
+ */
+int t_free(page_t vm_page, size_t n) {
+  page_t start_page = vm_page >> PG_LEN;
+  pthread_mutex_lock(&alloc_lock);
+  alloc_record *record = n ? find_covering_record(start_page) : find_record(start_page);
+
+  if (record && record->slab_page) {
+    int ret = slab_free(record->slab_page, vm_page);
+    pthread_mutex_unlock(&alloc_lock);
+    return ret;
+  }
+  page_t page_cnt = get_page_count(n);
+
+  if (n == 0 && record) {
+    page_cnt = record->page_cnt;
+  }
+
+  if (page_cnt == 0 || (record && start_page + page_cnt > record->vpn + record->page_cnt)) {
+    pthread_mutex_unlock(&alloc_lock);
+    return -1; // runs past the allocation into pages it does not own
+  }
+  // the record only changes once the pages are gone, a failed free keeps them
+  int ret = free_pages(start_page, page_cnt);
+
+  if (ret == 0 && record) {
+    page_t head_cnt = start_page - record->vpn;
+    page_t end_page = record->vpn + record->page_cnt;
+
+    if (start_page + page_cnt < end_page) {
+      add_record(start_page + page_cnt, end_page - start_page - page_cnt, NULL);
+    }
+
+    if (head_cnt) {
+      record->page_cnt = head_cnt;
+    } else {
+      remove_record(start_page);
+    }
+  }
+  pthread_mutex_unlock(&alloc_lock);
+  return ret;
+}
+
+int free_pages(page_t start_page, page_t page_cnt) {
+  pthread_mutex_lock(&mem_manager.vm_lock);
+  bool is_used = is_vm_range_used(start_page, page_cnt);
+  pthread_mutex_unlock(&mem_manager.vm_lock);
+
+  if (is_used == false) {
+    return -1;
+  }
+  // a huge page partly in the range is split, the rest of it stays mapped
+  page_t huge_cnt = (page_t)1 << huge_bits;
+  if (((start_page % huge_cnt) && split_huge(start_page)) ||
+      (((start_page + page_cnt) % huge_cnt) && split_huge(start_page + page_cnt - 1))) {
+    return -1;
+  }
+  for (page_t vpn = start_page; vpn < (start_page + page_cnt);) {
+    remove_TLB(vpn);
+    vpn += invalidate_pm(vpn);
+  }
+
+  // other threads drop their cached translations before the range is reused
+  __atomic_add_fetch(&tlb_epoch, 1, __ATOMIC_RELEASE);
+  pthread_mutex_lock(&mem_manager.vm_lock);
+  release_vm_range(start_page, page_cnt);
+  pthread_mutex_unlock(&mem_manager.vm_lock);
+  pthread_mutex_lock(&mem_manager.pm_lock);
+  mem_manager.frames_free += page_cnt;
+  pthread_mutex_unlock(&mem_manager.pm_lock);
+  return 0;
+}
+
+void copy_data(unsigned char *dest, const unsigned char *src, size_t n) {
+  memcpy(dest, src, n);
+}
+
+// pages are translated once each, and a run of them backed by consecutive
+// frames is moved with a single copy. -1 if the copy stops short at an
+// unmapped page or the end of the address space
+int access_memory(page_t vm_page, void *val, size_t n, bool read) {
+  page_t page_cnt = get_page_count(n);
+
+  if (page_cnt > total_virtual_pages) {
+    return -1;
+  }
+  page_t vm_index = vm_page >> PG_LEN;
+  page_t offset = vm_page & (PAGE_SIZE - 1);
+  page_t rw_opr = n;
+  unsigned char *p_val = val;
+  bool is_swap = mem_manager.swap_fd >= 0;
+  while (rw_opr > 0) {
+    if (vm_index >= total_virtual_pages) {
+      return -1;
     }
 
-    if (vm_index == vm_start) {
-      vp_data vpn_data;
-      read_vpn_data(vm_page, &vpn_data);
-      m_val += vpn_data.offset;
-      rw_data -= vpn_data.offset;
+    // with swap on, no frame of the run is evicted until it is copied
+    if (is_swap) {
+      pthread_rwlock_rdlock(&mem_manager.swap_lock);
     }
+    bool is_swapped = false;
+    page_t run_start = (page_t)walk_translate(vm_index << PG_LEN, &is_swapped) >> PG_LEN;
 
-    if (rw_opr < PAGE_SIZE) {
-      rw_data = rw_opr;
+    if (run_start == 0) {
+      if (is_swap) {
+        pthread_rwlock_unlock(&mem_manager.swap_lock);
+      }
+
+      if (is_swapped && swap_in(vm_index) == 0) {
+        continue;
+      }
+      return -1;
+    }
+    page_t run_size = PAGE_SIZE - offset;
+    while (run_size < rw_opr && (vm_index + 1) < total_virtual_pages) {
+      page_t pm_index = (page_t)walk_translate((vm_index + 1) << PG_LEN, &is_swapped) >> PG_LEN;
+
+      if (pm_index != run_start + (run_size + offset)/PAGE_SIZE) {
+        break; // the next page starts the next run
+      }
+      vm_index++;
+      run_size += PAGE_SIZE;
+    }
+
+    if (run_size > rw_opr) {
+      run_size = rw_opr;
     }
+    unsigned char *m_val = mem_manager.pg_mem + run_start*PAGE_SIZE + offset;
 
     if (read) {
-      copy_data(p_val, m_val, rw_data);
+      copy_data(p_val, m_val, run_size);
     } else {
-      copy_data(m_val, p_val, rw_data);
+      copy_data(m_val, p_val, run_size);
+    }
+
+    if (is_swap) {
+      pthread_rwlock_unlock(&mem_manager.swap_lock);
     }
-    rw_opr -= rw_data;
-    p_val += rw_data;
+    rw_opr -= run_size;
+    p_val += run_size;
+    offset = 0;
+    vm_index++;
   }
   return 0;
 }
@@ -412,76 +1468,363 @@ int get_value(page_t vm_page, void *val, size_t n) {
   return access_memory(vm_page, val, n, true);
 }
 
+// by address, then by position so values for the same address keep their order
+static int cmp_access(const void *a, const void *b) {
+  vm_access *x = *(vm_access *const *)a, *y = *(vm_access *const *)b;
+
+  if (x->addr != y->addr) {
+    return x->addr < y->addr ? -1 : 1;
+  }
+  return x < y ? -1 : x > y;
+}
+
+// the batch grouped by page, in a stable counting sort when its pages are
+// few enough for a count each, else sorted by address
+static vm_access **group_by_page(vm_access *accesses, size_t cnt) {
+  vm_access **sorted = malloc(cnt*sizeof(vm_access *));
+
+  if (sorted == NULL) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  bool is_ordered = true;
+  page_t low = cnt ? accesses[0].addr >> PG_LEN : 0, high = low;
+  for (size_t i = 0; i < cnt; i++) {
+    page_t vpn = accesses[i].addr >> PG_LEN;
+    sorted[i] = &accesses[i];
+    is_ordered &= (i == 0) || (accesses[i - 1].addr >> PG_LEN) <= vpn;
+    low = vpn < low ? vpn : low;
+    high = vpn > high ? vpn : high;
+  }
+
+  if (is_ordered) {
+    return sorted;
+  }
+
+  if (high - low >= cnt*BATCH_PAGE_SPREAD) {
+    qsort(sorted, cnt, sizeof(vm_access *), cmp_access);
+    return sorted;
+  }
+  size_t *starts = calloc(high - low + 2, sizeof(size_t));
+
+  if (starts == NULL) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < cnt; i++) {
+    starts[(accesses[i].addr >> PG_LEN) - low + 1]++;
+  }
+  for (page_t vpn = 1; vpn <= high - low; vpn++) {
+    starts[vpn] += starts[vpn - 1];
+  }
+  for (size_t i = 0; i < cnt; i++) {
+    sorted[starts[(accesses[i].addr >> PG_LEN) - low]++] = &accesses[i];
+  }
+  free(starts);
+  return sorted;
+}
+
+// the batch is visited page by page so every page is translated once for all
+// of its values; a value crossing a page boundary goes to access_memory.
+// -1 if an address is not mapped; the values on lower pages are done, in
+// whatever order the caller's array has them
+static int access_values(vm_access *accesses, size_t cnt, bool read) {
+  if (cnt == 0) {
+    return 0;
+  }
+  vm_access **sorted = group_by_page(accesses, cnt);
+  bool is_swap = mem_manager.swap_fd >= 0;
+  page_t curr_vpn = 0; // vpn 0 is never handed out
+  unsigned char *frame = NULL;
+  int ret = 0;
+  for (size_t i = 0; i < cnt && ret == 0; i++) {
+    vm_access *access = sorted[i];
+    page_t vpn = access->addr >> PG_LEN;
+    page_t offset = access->addr & (PAGE_SIZE - 1);
+
+    if (offset + access->len > PAGE_SIZE) {
+      if (is_swap && curr_vpn) {
+        pthread_rwlock_unlock(&mem_manager.swap_lock);
+      }
+      curr_vpn = 0;
+      ret = access_memory(access->addr, access->val, access->len, read);
+      continue;
+    }
+
+    // with swap on, the frame stays until the values of its page are copied
+    while (vpn != curr_vpn) {
+      if (is_swap && curr_vpn) {
+        pthread_rwlock_unlock(&mem_manager.swap_lock);
+      }
+      curr_vpn = 0;
+
+      if (is_swap) {
+        pthread_rwlock_rdlock(&mem_manager.swap_lock);
+      }
+      bool is_swapped = false;
+      frame = walk_translate(vpn << PG_LEN, &is_swapped);
+
+      if (frame) {
+        frame = mem_manager.pg_mem + (((page_t)frame >> PG_LEN) << PG_LEN);
+        curr_vpn = vpn;
+        break;
+      }
+
+      if (is_swap) {
+        pthread_rwlock_unlock(&mem_manager.swap_lock);
+      }
+
+      if (is_swapped == false || swap_in(vpn)) {
+        ret = -1;
+        break;
+      }
+    }
+
+    if (ret == 0 && read) {
+      copy_data(access->val, frame + offset, access->len);
+    } else if (ret == 0) {
+      copy_data(frame + offset, access->val, access->len);
+    }
+  }
+
+  if (is_swap && curr_vpn) {
+    pthread_rwlock_unlock(&mem_manager.swap_lock);
+  }
+  free(sorted);
+  return ret;
+}
+
+int put_values(vm_access *accesses, size_t cnt) {
+  return access_values(accesses, cnt, false);
+}
+
+int get_values(vm_access *accesses, size_t cnt) {
+  return access_values(accesses, cnt, true);
+}
+
+// rows x cols values from a matrix of stride bytes per row into tile, one
+// access per row so each page is translated once; values are widened to page_t
+void load_tile(page_t base, size_t stride, size_t rows, size_t cols, size_t val_size, page_t *tile) {
+  unsigned char raw[MAT_TILE*sizeof(page_t)];
+  for (size_t i = 0; i < rows; i++) {
+    page_t *row = tile + i*MAT_TILE;
+
+    if (val_size == sizeof(page_t)) {
+      get_value(base + i*stride, row, cols*val_size);
+      continue;
+    }
+    get_value(base + i*stride, raw, cols*val_size);
+    for (size_t j = 0; j < cols; j++) {
+      row[j] = 0;
+      memcpy(&row[j], raw + j*val_size, val_size);
+    }
+  }
+}
+
+void store_tile(page_t base, size_t stride, size_t rows, size_t cols, size_t val_size, page_t *tile) {
+  unsigned char raw[MAT_TILE*sizeof(page_t)];
+  for (size_t i = 0; i < rows; i++) {
+    page_t *row = tile + i*MAT_TILE;
+
+    if (val_size == sizeof(page_t)) {
+      put_value(base + i*stride, row, cols*val_size);
+      continue;
+    }
+    for (size_t j = 0; j < cols; j++) {
+      memcpy(raw + j*val_size, &row[j], val_size);
+    }
+    put_value(base + i*stride, raw, cols*val_size);
+  }
+}
+
 // original problem does not include the use of val_size,
 // but it has been added for more performing the operation correctly on the
-// type of variable that is used
+// type of variable that is used.
+// The product is built MAT_TILE x MAT_TILE blocks at a time: the tiles of l
+// and r are read in whole rows, multiplied locally and each output row of the
+// block is written once
 void mat_mult(page_t l, page_t r, page_t o, size_t col_l, size_t row_r, size_t common, size_t val_size) {
 // void mat_mult(page_t l, page_t r, page_t o, size_t col_l, size_t row_r, size_t common) {
 //   size_t val_size = PG_PTR_SIZE;
-  page_t value_l, value_r, value_o;
-  page_t address_l, address_r, address_o;
-  for (size_t i = 0; i < col_l; i++) {
-    for (size_t j = 0; j < row_r; j++) {
-      value_o = 0; //[i][j] = [i][k] * [k][j]
-      for (size_t k = 0; k < common; k++) {
-        address_l = l + (i*common*val_size) + (k*val_size);
-        address_r = r + (k*row_r*val_size) + (j*val_size);
-        get_value(address_l, &value_l, val_size);
-        get_value(address_r, &value_r, val_size);
-        value_o += (value_l*value_r);
+  if (val_size == 0 || val_size > sizeof(page_t)) {
+    return;
+  }
+  page_t tile_l[MAT_TILE*MAT_TILE], tile_r[MAT_TILE*MAT_TILE], tile_o[MAT_TILE*MAT_TILE];
+  for (size_t i0 = 0; i0 < col_l; i0 += MAT_TILE) {
+    size_t rows = (col_l - i0) < MAT_TILE ? (col_l - i0) : MAT_TILE;
+    for (size_t j0 = 0; j0 < row_r; j0 += MAT_TILE) {
+      size_t cols = (row_r - j0) < MAT_TILE ? (row_r - j0) : MAT_TILE;
+      memset(tile_o, 0, sizeof(tile_o));
+      for (size_t k0 = 0; k0 < common; k0 += MAT_TILE) {
+        size_t depth = (common - k0) < MAT_TILE ? (common - k0) : MAT_TILE;
+        load_tile(l + (i0*common + k0)*val_size, common*val_size, rows, depth, val_size, tile_l);
+        load_tile(r + (k0*row_r + j0)*val_size, row_r*val_size, depth, cols, val_size, tile_r);
+
+        // [i][j] += [i][k] * [k][j], the inner loop runs along rows of r and o
+        for (size_t i = 0; i < rows; i++) {
+          page_t *line_o = tile_o + i*MAT_TILE;
+          for (size_t k = 0; k < depth; k++) {
+            page_t value_l = tile_l[i*MAT_TILE + k];
+            page_t *line_r = tile_r + k*MAT_TILE;
+            for (size_t j = 0; j < cols; j++) {
+              line_o[j] += value_l*line_r[j];
+            }
+          }
+        }
       }
-      address_o = o + (i*row_r*val_size) + (j*val_size);
-      put_value(address_o, &value_o, val_size);
+      store_tile(o + (i0*row_r + j0)*val_size, row_r*val_size, rows, cols, val_size, tile_o);
     }
   }
 }
 
-void add_TLB(page_t vpage, page_t ppage) {
+// the asid shifts the set, spaces using the same addresses do not all
+// compete for the same sets
+tlb_data *get_TLB_set(page_t vpage) {
+  init_tlb();
+  page_t set = (vpage + get_space()->asid*TLB_ASID_STRIDE) & (mem_lookup.sets - 1);
+  return mem_lookup.table + set*mem_lookup.ways;
+}
+
+// huge pages are cached under vpage >> huge_bits, with PGFM_HUGE in the tag
+tlb_data *find_TLB_entry(page_t vpage, page_t flags) {
+  if (vpage == 0) {
+    return NULL;
+  }
+  int asid = get_space()->asid;
+  tlb_data *set = get_TLB_set(vpage);
+  for (int way = 0; way < mem_lookup.ways; way++) {
+    if ((set[way].vpn & (PGFM_VALID | PGFM_HUGE)) == (PGFM_VALID | flags) &&
+        ((set[way].vpn >> PG_LEN) == vpage) && set[way].asid == asid) {
+      return &set[way];
+    }
+  }
+  return NULL;
+}
+
+tlb_data *find_TLB(page_t vpage) {
+  return find_TLB_entry(vpage, 0);
+}
+
+void insert_TLB(page_t vpage, page_t ppage, page_t flags) {
   if (vpage == 0 || ppage == 0) {
     return;
   }
+  tlb_data *entry = find_TLB_entry(vpage, flags);
 
-  int pos = vpage % TLB_ENTRIES;
-  int vpn = vpage << PG_LEN;
-  int pfn = ppage << PG_LEN;
-  vpn |= PGFM_VALID; // first bit from offset
-  pfn |= PGFM_VALID; // first bit from offset
-  mem_lookup.table[pos].vpn = vpn;
-  mem_lookup.table[pos].pfn = pfn;
-}
+  if (entry == NULL) {
+    // a free way if there is one, else the least recently used
+    tlb_data *set = get_TLB_set(vpage);
+    entry = set;
+    for (int way = 0; way < mem_lookup.ways; way++) {
+      if ((set[way].vpn & PGFM_VALID) == 0) {
+        entry = &set[way];
+        break;
+      }
 
-int is_vpage_exists(page_t vpage, int pos) {
-  if (vpage == 0) {
-    return 0;
+      if (set[way].last_used < entry->last_used) {
+        entry = &set[way];
+      }
+    }
   }
+  entry->vpn = (vpage << PG_LEN) | PGFM_VALID | flags; // first bit from offset
+  entry->pfn = (ppage << PG_LEN) | PGFM_VALID; // first bit from offset
+  entry->last_used = ++mem_lookup.clock;
+  entry->asid = get_space()->asid;
+}
 
-  int is_valid = (mem_lookup.table[pos].vpn & PGFM_VALID);
-  return (is_valid > 0) && ((mem_lookup.table[pos].vpn >> PG_LEN) == vpage);
+void add_TLB(page_t vpage, page_t ppage) {
+  insert_TLB(vpage, ppage, 0);
 }
 
-int check_TLB(page_t vpage) {
-  int pos = vpage % TLB_ENTRIES;
+// one entry for the whole huge page holding vpage, ppage is its first frame
+void add_TLB_huge(page_t vpage, page_t ppage) {
+  insert_TLB(vpage >> huge_bits, ppage, PGFM_HUGE);
+}
+
+page_t check_TLB(page_t vpage) {
+  tlb_data *entry = find_TLB(vpage);
+  page_t pfn = entry ? entry->pfn : 0;
   mem_lookup.count++;
 
-  if (is_vpage_exists(vpage, pos)) {
+  if (entry == NULL && (entry = find_TLB_entry(vpage >> huge_bits, PGFM_HUGE))) {
+    pfn = entry->pfn + ((vpage & (((page_t)1 << huge_bits) - 1)) << PG_LEN);
+  }
+
+  if (entry) {
     mem_lookup.hit++;
-    return mem_lookup.table[pos].pfn;
+    entry->last_used = ++mem_lookup.clock;
+    return pfn;
   }
   mem_lookup.miss++;
   return 0;
 }
 
+pwc_data *get_PWC_entry(page_t vpage, int level) {
+  page_t prefix = vpage >> prefix_shift[level];
+  return &mem_lookup.pwc[level][prefix & (PWC_ENTRIES - 1)];
+}
+
+// the deepest level with a cached table for vpage, 0 (the root) without one
+int find_PWC(page_t vpage, page_t *table) {
+  page_t epoch = __atomic_load_n(&pwc_epoch, __ATOMIC_ACQUIRE);
+
+  if (mem_lookup.pwc_epoch != epoch) {
+    memset(mem_lookup.pwc, 0, sizeof(mem_lookup.pwc));
+    mem_lookup.pwc_epoch = epoch;
+  }
+  int asid = get_space()->asid;
+  mem_lookup.walks++;
+  for (int level = VPN_LEVELS - 1; level > 0; level--) {
+    pwc_data *entry = get_PWC_entry(vpage, level);
+
+    if (entry->table && entry->prefix == (vpage >> prefix_shift[level]) && entry->asid == asid) {
+      mem_lookup.levels_skipped += level;
+      *table = entry->table;
+      return level;
+    }
+  }
+  return 0;
+}
+
+void add_PWC(page_t vpage, int level, page_t table) {
+  pwc_data *entry = get_PWC_entry(vpage, level);
+  entry->prefix = vpage >> prefix_shift[level];
+  entry->table = table;
+  entry->asid = get_space()->asid;
+}
+
 int remove_TLB(page_t vpage) {
-  int pos = vpage % TLB_ENTRIES;
+  tlb_data *entry = find_TLB(vpage);
 
-  if (is_vpage_exists(vpage, pos)) {
-    reset_tlb_data(pos);
+  if (entry == NULL) {
+    entry = find_TLB_entry(vpage >> huge_bits, PGFM_HUGE);
+  }
+
+  if (entry) {
+    reset_tlb_data(entry);
     return 0;
   }
   return -1;
 }
 
+void print_swap_stats() {
+  pthread_rwlock_rdlock(&mem_manager.swap_lock);
+  double page_mb = PAGE_SIZE/(1024.0*1024.0);
+  printf("Swap outs %lu (%.1f MB/s), swap ins %lu (%.1f MB/s)\n",
+         (unsigned long)swap_outs, swap_out_secs > 0 ? swap_outs*page_mb/swap_out_secs : 0,
+         (unsigned long)swap_ins, swap_in_secs > 0 ? swap_ins*page_mb/swap_in_secs : 0);
+  pthread_rwlock_unlock(&mem_manager.swap_lock);
+}
+
+// over the calling thread and every thread that has exited
 void print_TLB_missrate() {
-  float miss_rate = mem_lookup.miss / mem_lookup.count;
-  printf("The TLB miss rate is, %.10f\n", miss_rate);
+  page_t count = mem_lookup.count + __atomic_load_n(&tlb_exited_count, __ATOMIC_RELAXED);
+  page_t miss = mem_lookup.miss + __atomic_load_n(&tlb_exited_miss, __ATOMIC_RELAXED);
+  double miss_rate = count ? (double)miss/count : 0;
+  printf("The TLB miss rate is, %.10f (%d sets x %d ways)\n", miss_rate,
+         tlb_sets, tlb_ways);
+  page_t walks = mem_lookup.walks + __atomic_load_n(&tlb_exited_walks, __ATOMIC_RELAXED);
+  page_t skipped = mem_lookup.levels_skipped + __atomic_load_n(&tlb_exited_skipped, __ATOMIC_RELAXED);
+  printf("Page walks %lu, %.2f of %d levels skipped per walk\n", (unsigned long)walks,
+         walks ? (double)skipped/walks : 0, VPN_LEVELS);
 }
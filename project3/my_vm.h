@@ -31,9 +31,28 @@ typedef uint32_t page_t;
 #define PG_PTR_SIZE sizeof(page_t)
 #define PAGE_MEM_SIZE (PAGE_SIZE / PG_PTR_SIZE)
 #define TLB_ENTRIES 512
+#define TLB_WAYS 4 // default geometry is TLB_ENTRIES/TLB_WAYS sets
+#define PWC_ENTRIES 16 // page walk cache entries per table level, direct mapped
+#define MAX_ASIDS 256   // address spaces alive at once, asid 0 is the default one
+#define TLB_ASID_STRIDE 37 // sets between the same vpn of consecutive asids
+
+#define SLAB_MIN_SIZE 8
+#define SLAB_MAX_SIZE (PAGE_SIZE/2)
+#define SLAB_CLASSES (PG_LEN - 3) // 8, 16, ... SLAB_MAX_SIZE bytes
+#define SLAB_MAP_WORDS ((PAGE_SIZE/SLAB_MIN_SIZE + 63)/64)
+#define ALLOC_BUCKETS 4096
+#define PM_ORDERS (PM_LEN - PG_LEN + 1) // buddy block sizes 1 .. all frames
+#define NO_FRAME ((page_t)-1)
+#define PHYS_MIN_FRAMES 64 // smallest pool set_physical_mem_size accepts
+#define PHYS_MAX_FRAMES ((page_t)1 << (PM_ORDERS - 1)) // one block of the largest buddy order
+#define MAT_TILE 32 // mat_mult works on MAT_TILE x MAT_TILE blocks
+#define BATCH_PAGE_SPREAD 4 // pages per value up to which a batch is counting sorted
 
 #define PGFM_SET (1UL << (PG_LEN - 1))
 #define PGFM_VALID (1UL << (PG_LEN - 2))
+#define PGFM_HUGE (1UL << (PG_LEN - 3)) // a second to last level entry mapping frames directly
+#define PGFM_SWAPPED (1UL << (PG_LEN - 4)) // not present, the entry holds a swap slot
+#define SWAP_LOW_FRAMES 16 // eviction keeps this many frames free for page tables
 
 typedef struct page {
   page_t hunk[PAGE_MEM_SIZE];
@@ -44,13 +63,21 @@ typedef struct {
   size_t num_bytes;
 } bitmap;
 
+// lock order is alloc_lock (my_vm.c), swap_lock, pt_lock, then pm_lock or
+// vm_lock; the last two never nest. alloc_lock comes first as slab pages are
+// mapped and unmapped under it, and t_free unmaps under it too
 typedef struct {
   unsigned char *pg_mem;
   bitmap *pm_bitmap;
-  bitmap *vm_bitmap;
-  page_t dir_index;
+  struct address_space *spaces[MAX_ASIDS]; // by asid, changed under pt_lock
   page_t frames_free;
   page_t page_frame_usage;
+  pthread_mutex_t pm_lock;  // pm_bitmap, frames_free, page table frames
+  pthread_mutex_t vm_lock;  // vm_free of every space, the virtual range allocator
+  pthread_rwlock_t pt_lock; // page table entries, walks take it shared
+  int swap_fd;              // -1 unless set_swap_file enabled overcommit
+  bitmap *swap_bitmap;      // used swap slots, under pm_lock
+  pthread_rwlock_t swap_lock; // copies take it shared, eviction exclusive
 } vm_manager;
 
 typedef struct {
@@ -62,13 +89,84 @@ typedef struct {
 typedef struct {
   page_t vpn;
   page_t pfn;
+  page_t last_used; // lookup clock at the last hit, lowest is evicted
+  int asid;         // entries of other address spaces stay, they never match
 } tlb_data;
 
+// a run of free virtual pages; a treap on start, so first fit and coalescing
+// are logarithmic and memory grows with fragments, not the address space
+typedef struct vm_range {
+  page_t start;
+  page_t len;
+  page_t max_len; // longest run in this subtree, steers the first fit search
+  unsigned int prio;
+  struct vm_range *left;
+  struct vm_range *right;
+} vm_range;
+
+// buddy free list links, indexed by the first frame of each free block and
+// kept outside the emulated memory so free frames are never touched
+typedef struct {
+  page_t next;
+  page_t prev;
+} frame_link;
+
+// a page holding same sized objects, kept outside the emulated memory
+typedef struct slab {
+  page_t vpn;
+  int size_class;
+  int used;
+  uint64_t used_map[SLAB_MAP_WORDS];
+  struct slab *next; // in the partial list of its class
+} slab;
+
+// what t_free needs to know about an allocation, hashed by its first vpn
+typedef struct alloc_record {
+  page_t vpn;
+  page_t page_cnt;
+  slab *slab_page; // set for slab pages, which hold many allocations
+  struct alloc_record *next;
+} alloc_record;
+
+// one value of a get_values/put_values batch, len bytes at addr from or to val
+typedef struct {
+  page_t addr;
+  void *val;
+  size_t len;
+} vm_access;
+
+// an isolated address space with its own page tables, virtual ranges and
+// allocations; each thread works in one, see switch_address_space
+typedef struct address_space {
+  int asid;
+  page_t dir_index;
+  struct vm_range *vm_free;             // under vm_lock
+  alloc_record *records[ALLOC_BUCKETS]; // under alloc_lock, as are the slabs
+  slab *slab_partial[SLAB_CLASSES];
+} address_space;
+
+// the table a walk reaches after the vpn prefix; tables are only freed with
+// their address space, which flushes every page walk cache
+typedef struct {
+  page_t prefix;
+  page_t table; // 0 for an empty entry, frame 0 is never a table
+  int asid;
+} pwc_data;
+
+// one per thread, t_free anywhere bumps tlb_epoch and stale TLBs flush
 typedef struct {
-  tlb_data table[TLB_ENTRIES];
-  int count;
-  int miss;
-  int hit;
+  tlb_data *table; // sets * ways entries, the ways of a set are adjacent
+  int sets;
+  int ways;
+  page_t epoch;
+  page_t clock;
+  page_t count;
+  page_t miss;
+  page_t hit;
+  pwc_data pwc[VPN_LEVELS][PWC_ENTRIES]; // level 0, the root, is not cached
+  page_t pwc_epoch;
+  page_t walks;
+  page_t levels_skipped;
 } tlb_lookup;
 
 void initialize_vm();
@@ -91,16 +189,47 @@ void set_physical_mem();
 
 void read_vpn_data(page_t vm_page, vp_data *vpn_data);
 
+page_t *get_pt_entry(page_t table, page_t index);
+
 void *translate(page_t vpn);
 
-void invalidate_pm(page_t vpn);
+void *walk_translate(page_t vpn, bool *is_swapped);
+
+int swap_in(page_t vpn);
+
+int evict_frame();
+
+page_t invalidate_pm(page_t vpn);
+
+int split_huge(page_t vpn);
 
-void page_map(page_t vm_page, page_t pm_frame);
+int page_map(page_t vm_page, page_t pm_frame);
+
+int page_map_huge(page_t vm_page, page_t pm_frame);
+
+int frame_alloc(int order, page_t *frame);
+
+void frame_free(page_t frame, int order);
 
 int get_next_avail(int page_cnt, page_t *start_page);
 
+vm_range *new_vm_range(page_t start, page_t len);
+
+int get_vm_start_page(page_t page_cnt, page_t *start_page);
+
+int get_vm_aligned_pages(page_t page_cnt, page_t align, page_t *start_page);
+
+void release_vm_range(page_t start_page, page_t page_cnt);
+
+bool is_vm_range_used(page_t start_page, page_t page_cnt);
+
+page_t alloc_pages(page_t page_cnt);
+
+int free_pages(page_t start_page, page_t page_cnt);
+
 void *t_malloc(size_t n);
 
+// n can be 0, the size is recorded by t_malloc
 int t_free(page_t vm_page, size_t n);
 
 void copy_data(unsigned char *dest, const unsigned char *src, size_t n);
@@ -111,12 +240,42 @@ int put_value(page_t vm_page, void *val, size_t n);
 
 int get_value(page_t vm_page, void *val, size_t n);
 
+int put_values(vm_access *accesses, size_t cnt);
+
+int get_values(vm_access *accesses, size_t cnt);
+
+void load_tile(page_t base, size_t stride, size_t rows, size_t cols, size_t val_size, page_t *tile);
+
+void store_tile(page_t base, size_t stride, size_t rows, size_t cols, size_t val_size, page_t *tile);
+
 void mat_mult(page_t l, page_t r, page_t o, size_t col_l, size_t row_r, size_t common, size_t val_size);
 // void mat_mult(page_t l, page_t r, page_t o, size_t col_l, size_t row_r, size_t common);
 
+int set_physical_mem_size(size_t size);
+
+int set_swap_file(const char *path, size_t size);
+
+void print_swap_stats();
+
+address_space *get_space();
+
+address_space *create_address_space();
+
+address_space *switch_address_space(address_space *space);
+
+int destroy_address_space(address_space *space);
+
+int set_TLB_geometry(int sets, int ways);
+
 void add_TLB(page_t vpage, page_t ppage);
 
-int check_TLB(page_t vpage);
+void add_TLB_huge(page_t vpage, page_t ppage);
+
+page_t check_TLB(page_t vpage);
+
+int find_PWC(page_t vpage, page_t *table);
+
+void add_PWC(page_t vpage, int level, page_t table);
 
 int remove_TLB(page_t vpage);
 